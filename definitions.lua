@@ -368,6 +368,8 @@ log = {
 ---@field origin string Lua "file:line" where the worker was created, or "<CPP>"
 ---@field destroy fun(self: Worker) synchronously stop and delete the worker
 ---@field shutdown fun(self: Worker): promise<nil> asynchronously stop the worker; await it to know when it has finished
+---@field want fun(self: Worker, field: string) announce a consumer of `field` (on() does this for you)
+---@field unwant fun(self: Worker, field: string) drop one consumer added with want()
 
 ---@alias pipeInput (Events | MsgHandler)
 
@@ -461,6 +463,16 @@ function Sql (params) end
 
 ---@class ModbusSlaveDevice
 
+---@class TcpModbusDeviceParams
+---@field host string
+---@field port number
+---@field name string?
+---@field frame_gap number? ms between requests when not pipelined (default 25)
+---@field slave_backoff_ms number? skip a timed out slave for this long, doubled per timeout in a row (default 1000)
+---@field max_slave_backoff_ms number? (default 30000)
+---@field max_in_flight number? outstanding transactions per connection (default 1)
+---@field connections number? parallel connections to the host (default 1)
+
 ---@class WorkerBaseParams
 ---@field name string? explicit unique worker name (auto-generated if omitted)
 ---@field category string? log category override
@@ -471,17 +483,61 @@ function Sql (params) end
 ---@field poll_rate number? milliseconds between polls (default 500)
 ---@field response_time number? ms to wait for response (default 150)
 ---@field write_retries number? (default 3)
+---@field max_gap number? unused registers that may be read to merge two polls into one request (default 0)
+---@field max_regs_per_request number? holding/input registers per request, 1-125 (default 125)
+---@field max_bits_per_request number? coils/discrete inputs per request, 1-2000 (default 2000)
+---@field poll_groups table<string, number>? scan classes: group name -> poll rate (ms). Registers without `group` use "default" (poll_rate)
+---@field poll_on_demand boolean? poll only registers with consumers (on(), tags.subscribe, tags.changed[...]). Default false
+---@field weight number? on a device shared by several slaves: requests this slave may send in a row before the next slave's turn (default 1, plain round-robin)
 ---@field registers ModbusRegistersMap
 
+---@class ModbusPollGroupStats
+---@field rate number
+---@field requests number requests per cycle
+---@field pending number
+---@field cycles number
+---@field overruns number cycles skipped because the previous one was still pending
+
+---@class ModbusMasterWorker: Worker
+local ModbusMasterWorker = {}
+
+---@return table<string, ModbusPollGroupStats>
+function ModbusMasterWorker:Stats() end
+
+---@class ModbusSlaveStats
+---@field requests number
+---@field errors number
+---@field timeouts number
+---@field last_ms number
+---@field max_ms number
+---@field avg_ms number moving average of response times
+---@field queued_reads number
+---@field queued_writes number
+---@field backoff_ms number remaining time this slave is skipped after timeouts
+---@field overflows number requests dropped because the queue was full
+---@field p50_ms number latency percentiles over the last 512 requests
+---@field p95_ms number
+---@field p99_ms number
+---@field latency_hist number[] requests per latency bucket since start. The difference of two snapshots covers exactly the requests in between
+---@field latency_bounds_ms number[] upper bound of each latency_hist bucket (8 per doubling, from 0.01 ms)
+
+---Bus statistics of this master's slave_id on its device
+---@return ModbusSlaveStats
+function ModbusMasterWorker:SlaveStats() end
+
 ---@class ModbusSlaveParams: WorkerBaseParams
 ---@field device ModbusSlaveDevice
 ---@field slave_id number
 ---@field registers ModbusRegistersMap
+---@field write_batch_ms number? client writes within this window (ms) are reported as one message. Default 0: writes handled in the same event loop turn
 
 ---@class ModbusRegister
 ---@field index number 0-based register index
----@field type ("uint16"|"uint32"|"float32")?
+---@field type ("uint16"|"int16"|"uint32"|"int32"|"float32"|"float64")? value type (block element type if `count` is set)
+---@field count number? read/write a block of `count` values as one key. Blocks longer than one request (125 registers / 2000 bits) are read in several requests; writable blocks must fit into one write (123 registers / 1968 coils), so make longer ones mode = "r"
+---@field format ("list"|"bytes")? blocks as a Lua array (default) or as native-endian bytes
 ---@field mode ("r"|"rw"|"w")?
+---@field group string? poll group (see ModbusMasterParams.poll_groups)
 
 ---@class ModbusRegistersMap
 ---@field holding table<string, ModbusRegister>?
@@ -489,7 +545,7 @@ function Sql (params) end
 ---@field di table<string, ModbusRegister>?
 ---@field input table<string, ModbusRegister>?
 
----@return Worker
+---@return ModbusMasterWorker
 ---@param params ModbusMasterParams
 function ModbusMaster(params) end
 
@@ -498,6 +554,7 @@ function ModbusMaster(params) end
 function ModbusSlave(params) end
 
 ---@return ModbusMasterDevice
+---@param params TcpModbusDeviceParams
 function TcpModbusDevice(params) end
 ---@return ModbusMasterDevice
 function RtuModbusDevice(params) end
@@ -507,6 +564,18 @@ function TcpModbusServer(params) end
 ---@return ModbusSlaveDevice
 function RtuModbusServer(params) end
 
+---@class ModbusGatewayForward
+---@field device ModbusMasterDevice downstream bus, unit ids are passed through as slave ids
+---@field units number[]? unit ids routed to `device`; omit for every unit without a local slave
+
+---@class TcpModbusGatewayParams: TcpModbusDeviceParams
+---@field forward ModbusGatewayForward[]? read/write requests (FC 1-6, 15, 16) for units not served locally
+
+---One listening port for many ModbusSlave workers, routed by unit id (= their slave_id)
+---@param params TcpModbusGatewayParams
+---@return ModbusSlaveDevice
+function TcpModbusGateway(params) end
+
 ---@class QMLWorker: Worker
 QMLWorker = {}
 
@@ -682,15 +751,60 @@ function RedisCacheWorker:Exec(query, args) end
 ---@return nil
 function RedisCacheWorker:Exec(query, args, callback) end
 
+---Run a server-side Lua script with EVALSHA. Only its SHA is sent: the script text goes
+---over the wire (SCRIPT LOAD) on first use and after the server lost it (NOSCRIPT)
+---@param script string
+---@param keys any[]
+---@param args any[]
+---@return fun(defer: RedisCallback)
+function RedisCacheWorker:Eval(script, keys, args) end
+
+---@param script string
+---@param keys any[]
+---@param args any[]
+---@param callback RedisCallback
+---@return nil
+function RedisCacheWorker:Eval(script, keys, args, callback) end
+
 ---@class RedisConfig
 ---@field host string?
 ---@field port number?
 ---@field db number?
 ---@field reconnect_timeout number?
+---@field protocol 2|3? 3: negotiate RESP3 (Redis 6+). RedisCache in "full" sync then follows the hash with CLIENT TRACKING invalidations on its single connection instead of keyevents
+
+---@class RedisConnection
+RedisConnection = {}
+
+---@class RedisConnectionConfig : RedisConfig
+---@field pool_size number? command connections opened at most, workers are spread over them (default 2)
+
+---Connections shared by RedisCache/RedisStream workers (`connection = ...`): each worker sticks to one
+---connection of the pool, keyspace/changes subscriptions of all workers go over one pub/sub connection.
+---RedisStream reads still block, so every reading stream keeps one connection of its own
+---@param params RedisConnectionConfig
+---@return RedisConnection
+function RedisConnection(params) end
+
+---How hash fields / stream entry values are stored:
+---"string" (default): tostring() of every leaf, one field per leaf.
+---"msgpack": typed binary values; with field_depth = N messages are split into fields only N levels deep,
+---deeper subtrees are stored whole under one field (0: one field per leaf)
+---@alias RedisValueEncoding "string"|"msgpack"
 
 ---@class RedisCacheConfig : RedisConfig
 ---@field hash_key string?
 ---@field enable_keyevents boolean?
+---@field mode "r"|"w"|"rw"?
+---@field flush_interval number? ms to collect updates (last value per field wins) before one HSET. Default 0: write each message
+---@field max_batch number? flush as soon as this many fields are pending. Default 0: no limit
+---@field delete_invalid boolean? remove fields set to nil with HDEL. Default false (written as "")
+---@field sync "full"|"changes"? full (default): HGETALL on every keyevent of the hash; changes: apply the fields writers publish to `changes_channel`, HGETALL only on (re)connect
+---@field changes_channel string? default "<hash_key>:changes"; payload is a JSON object of changed fields (null = deleted), values keep their JSON type
+---@field poll_debounce number? ms to merge keyevents into one HGETALL in "full" mode. Default 0
+---@field encoding RedisValueEncoding?
+---@field field_depth number? see RedisValueEncoding
+---@field connection RedisConnection? share its connections, host/port/db/protocol are taken from it
 
 ---@return RedisCacheWorker
 ---@param params RedisCacheConfig
@@ -698,13 +812,52 @@ function RedisCache(params) end
 
 ---@class RedisStreamConfig : RedisConfig
 ---@field stream_key string
+---@field entries_per_read number? (default 1000)
+---@field max_entries_per_read number? batch size grows up to this while catching up (default 10000)
+---@field group string? read as a member of this consumer group (XREADGROUP + XACK), created if missing
+---@field consumer string? consumer name within `group`, unique per instance (default: instance_id)
+---@field claim_idle_ms number? on start, claim other consumers' entries pending for this long (default 60000)
+---@field stream_size number? approximate (MAXLEN ~) stream length kept on writes (default 1000000)
+---@field flush_interval number? ms to queue written entries before sending them as one pipelined block of XADDs. Default 0
+---@field max_batch number? send as soon as this many entries are queued. Default 0: no limit
+---@field emit_ids boolean? emit an `{ids = {...}}` event per block, ids in message order (nil if an XADD failed)
+---@field encoding RedisValueEncoding?
+---@field field_depth number? see RedisValueEncoding
+---@field connection RedisConnection? writes go over its pool, host/port/db/protocol are taken from it
 ---TODO: other fields and enums
 
 ---@return Worker
 ---@param params RedisStreamConfig
 function RedisStream(params) end
 
----@return Worker
+---@class WebsocketServerConfig : WorkerConfig
+---@field port number
+---@field host string? (default "0.0.0.0")
+---@field protocol ("json"|"msgpack")? -- frame payload encoding (default "json")
+---@field compression "zlib"? -- optional payload compression
+---@field per_client boolean? -- route per connection ({addr=msg}); else broadcast (default false)
+---@field sync ("none"|"delta")? -- delta: merge messages into one state, send it to new clients, then only changes (nil = deleted)
+---@field client_buffer_limit number? -- bytes queued for a client before it counts as slow (default 1 MiB); delta: it is resynced with the state once drained
+---@field on_slow_client ("conflate"|"drop_oldest"|"disconnect")? -- what a slow client gets: held messages merged by path and sent as one once drained (default), up to `max_client_queue` held messages with the oldest dropped, or disconnected
+---@field max_client_queue number? -- drop_oldest: messages held per client (default 100)
+
+---@class WebsocketClientStats
+---@field queued_bytes number -- in the socket's write buffer now
+---@field max_queued_bytes number
+---@field held number -- messages (drop_oldest) or fields (conflate) waiting for the client to drain
+---@field sent number
+---@field dropped number
+---@field merged number -- values overwritten by newer ones while held (conflate)
+---@field resyncs number -- snapshots sent after falling behind (delta sync)
+
+---@class WebsocketServerWorker: Worker
+WebsocketServerWorker = {}
+
+---@return table<string, WebsocketClientStats> by client address
+function WebsocketServerWorker:Clients() end
+
+---@param params WebsocketServerConfig
+---@return WebsocketServerWorker
 function WebsocketServer(params) end
 
 ---@return Worker
@@ -1106,12 +1259,12 @@ function Cyphal(params) end
 ---@class TagEvent
 ---@field name string      tag name in "worker:field" form
 ---@field value any        current value
----@field quality "good" | "comm_fail"
+---@field quality "good" | "comm_fail" | "stale"
 ---@field ts number        milliseconds since epoch
 
 ---@class TagInfo
 ---@field value any
----@field quality "good" | "comm_fail"
+---@field quality "good" | "comm_fail" | "stale"
 ---@field ts number
 
 ---@class TagChanged: Pipable
@@ -1134,4 +1287,18 @@ function tags:get(name) end
 ---Return the Worker object that owns the tag, or nil if not yet known.
 ---@param name string
 ---@return Worker?
-function tags:source(name) end
\ No newline at end of file
+function tags:source(name) end
+
+---Publish all tags into a shared-memory table that other local processes can read
+---lock-free (POSIX: `/dev/shm/<name>`; Windows: named file mapping). Layout is
+---described in `include/radapter/tag_shm.hpp`. Can be called once per instance.
+---@param name string segment name
+---@param slots integer? max number of published tags (default 4096)
+function tags:share(name, slots) end
+
+---Mark tags "stale" once they have not been updated for `ms` milliseconds (checked
+---every 100ms). `target` is a tag name ("worker:field"), or a worker / worker name
+---to cover all of its tags; a per-tag limit wins over the per-worker one. 0 disables.
+---@param target string|Worker
+---@param ms integer
+function tags:max_age(target, ms) end
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef RADAPTER_TAG_SHM_HPP
+#define RADAPTER_TAG_SHM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Layout of the shared-memory tag table published by `tags:share()`.
+// Qt-free and header-only, so external readers (a C++ historian, a Python job
+// using mmap) can map the segment and read current values without a socket.
+//
+//   [Header][Slot x slot_count][DirEntry x slot_count]
+//
+// All integers are native-endian. Slots are claimed in order and never reused:
+// the directory entry of slot N is written before `used` is bumped past N
+// (release), so a reader that loads `used` (acquire) may trust names below it.
+// Each slot value is guarded by a seqlock: an odd `seq` means a write is in
+// progress, and a reader retries if `seq` changed while it copied the value.
+namespace radapter::tagshm {
+
+constexpr uint32_t Magic = 0x47415452; // "RTAG"
+constexpr uint32_t Version = 1;
+constexpr size_t NameSize = 96;        // NUL-terminated; longer tag names are not published
+constexpr size_t InlineSize = 40;      // t_string payloads are truncated to this
+
+enum Type : uint8_t {
+    t_nil,
+    t_bool,
+    t_int,
+    t_double,
+    t_string,
+};
+
+// mirrors radapter::TagRegistry::Quality
+enum Quality : uint8_t {
+    q_good,
+    q_comm_fail,
+    q_stale,
+};
+
+struct Value {
+    uint8_t type;
+    uint8_t quality;
+    uint16_t size; // t_string: bytes used in `data.str`
+    int64_t ts;    // ms since epoch of the last update
+    union {
+        int64_t i; // t_bool (0/1), t_int
+        double d;  // t_double
+        char str[InlineSize];
+    } data;
+};
+
+struct alignas(64) Slot {
+    std::atomic<uint32_t> seq;
+    Value value;
+};
+
+struct DirEntry {
+    char name[NameSize];
+};
+
+struct alignas(64) Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size; // sizeof(Slot), lets readers validate the layout
+    uint32_t name_size;
+    std::atomic<uint32_t> used;
+    int64_t pid;        // writer process
+};
+
+static_assert(sizeof(Slot) == 64, "tagshm::Slot must stay one cache line");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs lock-free atomics");
+
+inline size_t SegmentSize(uint32_t slots) noexcept {
+    return sizeof(Header) + size_t(slots) * (sizeof(Slot) + sizeof(DirEntry));
+}
+
+inline Slot* Slots(Header* h) noexcept {
+    return reinterpret_cast<Slot*>(h + 1);
+}
+
+inline Slot const* Slots(Header const* h) noexcept {
+    return reinterpret_cast<Slot const*>(h + 1);
+}
+
+inline DirEntry* Directory(Header* h) noexcept {
+    return reinterpret_cast<DirEntry*>(Slots(h) + h->slot_count);
+}
+
+inline DirEntry const* Directory(Header const* h) noexcept {
+    return reinterpret_cast<DirEntry const*>(Slots(h) + h->slot_count);
+}
+
+inline bool Valid(Header const* h) noexcept {
+    return h->magic == Magic && h->version == Version
+        && h->slot_size == sizeof(Slot) && h->name_size == NameSize;
+}
+
+// single writer only
+inline void Write(Slot& s, Value const& v) noexcept {
+    auto seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(static_cast<void*>(&s.value), &v, sizeof(Value));
+    s.seq.store(seq + 2, std::memory_order_release);
+}
+
+//! @return false if the writer kept the slot busy for all `attempts`
+inline bool Read(Slot const& s, Value& out, unsigned attempts = 100) noexcept {
+    for (unsigned i = 0; i < attempts; ++i) {
+        auto before = s.seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        std::memcpy(&out, static_cast<const void*>(&s.value), sizeof(Value));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+}
+
+#endif //RADAPTER_TAG_SHM_HPP
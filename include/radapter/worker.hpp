@@ -51,6 +51,7 @@ public:
     string _LogCat;
     string _Origin; // "file:line" of the creating Lua call, or "<CPP>"
     int _luaSelfRef = -1; // Lua registry ref to this worker's userdata (LUA_NOREF); set by push_worker
+    QMap<QString, int> _Demand; // consumer count per field, see AddDemand()
 
     Worker(Instance* parent, const char* category);
     Worker(Instance* parent, WorkerConfig const& conf, const char* category);
@@ -62,6 +63,11 @@ public:
     bool TagsEnabled() const;
     void AdvertiseFields(QStringList const& fields);
 
+    // consumers (tag subscribers, on() listeners) announce the fields they read,
+    // workers that can skip unused data override OnDemandChanged()
+    void AddDemand(QString const& field);
+    void RemoveDemand(QString const& field);
+
     void Log(LogLevel lvl, fmt::string_view fmt, fmt::format_args args);
 
     template<typename...Args>
@@ -93,6 +99,7 @@ public:
     virtual ~Worker();
 protected:
     QVariant CurrentSender();
+    virtual void OnDemandChanged() {}
 signals:
     void ShutdownDone();
     void SendMsg(QVariant const& msg);
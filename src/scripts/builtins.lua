@@ -103,7 +103,20 @@ function pipe(first, ...)
 end
 
 function on(worker, part, handler)
-    return pipe(worker, unwrap(part), handler)
+    local cancel = pipe(worker, unwrap(part), handler)
+    if type(worker) ~= "userdata" or type(part) ~= "string" or not worker.want then
+        return cancel
+    end
+    -- let the worker know `part` is read (e.g. ModbusMaster poll_on_demand)
+    worker:want(part)
+    local active = true
+    return function()
+        cancel()
+        if active then
+            active = false
+            worker:unwant(part)
+        end
+    end
 end
 
 -- Cross-version compatability
@@ -0,0 +1,180 @@
+#include "tag_shm.hpp"
+#include <QCoreApplication>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace radapter {
+
+#ifndef Q_OS_WIN
+static std::string shmPath(QString const& name) {
+    return name.startsWith('/') ? name.toStdString() : "/" + name.toStdString();
+}
+#endif
+
+TagShm::TagShm(Instance* inst, QString const& name, uint32_t slots) : _inst(inst), _name(name) {
+    if (!slots) {
+        Raise("tags:share(): slot count must be positive");
+    }
+    _size = tagshm::SegmentSize(slots);
+    void* mem = nullptr;
+#ifdef Q_OS_WIN
+    auto wname = name.toStdWString();
+    auto size64 = quint64(_size);
+    auto h = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                DWORD(size64 >> 32), DWORD(size64 & 0xFFFFFFFF), wname.c_str());
+    if (!h) {
+        Raise("tags:share(): could not create mapping '{}' (error {})", name, GetLastError());
+    }
+    mem = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+    if (!mem) {
+        auto err = GetLastError();
+        CloseHandle(h);
+        Raise("tags:share(): could not map '{}' (error {})", name, err);
+    }
+    _handle = h;
+#else
+    auto path = shmPath(name);
+    int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        Raise("tags:share(): shm_open({}) failed: {}", path, strerror(errno));
+    }
+    if (ftruncate(fd, off_t(_size)) != 0) {
+        auto err = errno;
+        ::close(fd);
+        shm_unlink(path.c_str());
+        Raise("tags:share(): could not resize {}: {}", path, strerror(err));
+    }
+    mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        auto err = errno;
+        shm_unlink(path.c_str());
+        Raise("tags:share(): mmap({}) failed: {}", path, strerror(err));
+    }
+#endif
+    memset(mem, 0, _size);
+    _hdr = new (mem) tagshm::Header{};
+    _hdr->slot_count = slots;
+    _hdr->slot_size = uint32_t(sizeof(tagshm::Slot));
+    _hdr->name_size = uint32_t(tagshm::NameSize);
+    _hdr->pid = QCoreApplication::applicationPid();
+    auto* s = tagshm::Slots(_hdr);
+    for (uint32_t i = 0; i < slots; ++i) {
+        new (s + i) tagshm::Slot{};
+    }
+    _hdr->version = tagshm::Version;
+    std::atomic_thread_fence(std::memory_order_release);
+    _hdr->magic = tagshm::Magic; // last: readers treat a segment without magic as not ready
+}
+
+TagShm::~TagShm() {
+    if (!_hdr) return;
+    _hdr->magic = 0;
+#ifdef Q_OS_WIN
+    UnmapViewOfFile(_hdr);
+    CloseHandle(static_cast<HANDLE>(_handle));
+#else
+    munmap(_hdr, _size);
+    shm_unlink(shmPath(_name).c_str());
+#endif
+}
+
+int TagShm::claim(QString const& tagName) {
+    auto utf8 = tagName.toUtf8();
+    if (size_t(utf8.size()) >= tagshm::NameSize) {
+        return -2;
+    }
+    auto used = _hdr->used.load(std::memory_order_relaxed);
+    if (used >= _hdr->slot_count) {
+        return -1;
+    }
+    auto& entry = tagshm::Directory(_hdr)[used];
+    memcpy(entry.name, utf8.constData(), size_t(utf8.size()));
+    entry.name[utf8.size()] = '\0';
+    _hdr->used.store(used + 1, std::memory_order_release);
+    return int(used);
+}
+
+void TagShm::Publish(QString const& tagName, int& slot, QVariant const& value, qint64 ts, uint8_t quality) {
+    if (slot == -2) return;
+    if (slot < 0) {
+        slot = claim(tagName);
+        if (slot == -2) {
+            _inst->Warn("tags", "'{}': name too long for shared table '{}' (max {} bytes)",
+                        tagName, _name, tagshm::NameSize - 1);
+            return;
+        }
+        if (slot < 0) {
+            if (!_fullWarned) {
+                _fullWarned = true;
+                _inst->Warn("tags", "shared table '{}' is full ({} slots), new tags are not published",
+                            _name, _hdr->slot_count);
+            }
+            return;
+        }
+    }
+    tagshm::Value v{};
+    v.quality = quality;
+    v.ts = ts;
+    switch (value.metaType().id()) {
+    case QMetaType::UnknownType:
+        v.type = tagshm::t_nil;
+        break;
+    case QMetaType::Bool:
+        v.type = tagshm::t_bool;
+        v.data.i = value.toBool() ? 1 : 0;
+        break;
+    case QMetaType::SChar:
+    case QMetaType::Short:
+    case QMetaType::Int:
+    case QMetaType::Long:
+    case QMetaType::LongLong:
+    case QMetaType::UChar:
+    case QMetaType::UShort:
+    case QMetaType::UInt:
+    case QMetaType::ULong:
+        v.type = tagshm::t_int;
+        v.data.i = value.toLongLong();
+        break;
+    case QMetaType::ULongLong: {
+        auto u = value.toULongLong();
+        if (u > quint64((std::numeric_limits<qint64>::max)())) {
+            v.type = tagshm::t_double;
+            v.data.d = double(u);
+        } else {
+            v.type = tagshm::t_int;
+            v.data.i = qint64(u);
+        }
+        break;
+    }
+    case QMetaType::Float:
+    case QMetaType::Double:
+        v.type = tagshm::t_double;
+        v.data.d = value.toDouble();
+        break;
+    default: {
+        auto bytes = value.metaType().id() == QMetaType::QByteArray
+                         ? value.toByteArray()
+                         : value.toString().toUtf8();
+        auto n = (std::min)(size_t(bytes.size()), tagshm::InlineSize);
+        v.type = tagshm::t_string;
+        v.size = uint16_t(n);
+        memcpy(v.data.str, bytes.constData(), n);
+        break;
+    }
+    }
+    tagshm::Write(tagshm::Slots(_hdr)[slot], v);
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "radapter/radapter.hpp"
+#include "radapter/tag_shm.hpp"
+
+namespace radapter {
+
+// Writer side of the shared-memory tag table (see radapter/tag_shm.hpp).
+// POSIX shm_open() on Unix (readable as /dev/shm/<name>), a named file mapping on Windows.
+class TagShm {
+public:
+    TagShm(Instance* inst, QString const& name, uint32_t slots);
+    ~TagShm();
+    TagShm(TagShm const&) = delete;
+    TagShm& operator=(TagShm const&) = delete;
+
+    QString const& Name() const { return _name; }
+
+    //! `slot` caches the tag's slot index (-1 = not claimed yet, -2 = not publishable)
+    void Publish(QString const& tagName, int& slot, QVariant const& value, qint64 ts, uint8_t quality);
+private:
+    int claim(QString const& tagName);
+
+    Instance* _inst;
+    QString _name;
+    tagshm::Header* _hdr = nullptr;
+    size_t _size = 0;
+    void* _handle = nullptr;
+    bool _fullWarned = false;
+};
+
+}
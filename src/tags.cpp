@@ -2,9 +2,14 @@
 #include "builtin.hpp"
 #include "glua/glua.hpp"
 #include "instance_impl.hpp"
+#include <QTimer>
 
 namespace radapter {
 
+static_assert(uint8_t(TagRegistry::Quality::Good) == tagshm::q_good);
+static_assert(uint8_t(TagRegistry::Quality::CommFail) == tagshm::q_comm_fail);
+static_assert(uint8_t(TagRegistry::Quality::Stale) == tagshm::q_stale);
+
 static int changed_get_listeners(lua_State* L) {
     lua_pushvalue(L, lua_upvalueindex(1));
     return 1;
@@ -54,6 +59,8 @@ TagRegistry::TagRegistry(Instance* inst) : QObject(inst), _inst(inst) {
     lua_pop(L, 1);
 
     connect(inst, &Instance::WorkerCreated, this, &TagRegistry::onWorkerCreated);
+
+    _clock.start();
 }
 
 void TagRegistry::onWorkerCreated(Worker* w) {
@@ -64,6 +71,7 @@ void TagRegistry::onWorkerCreated(Worker* w) {
         if (!tag.source) {
             tag.source = w;
             tag.field = it.key().mid(wname.size() + 1);
+            tag.maxAge = -1;
         }
     }
 }
@@ -75,12 +83,38 @@ void TagRegistry::Advertise(Worker* w, QStringList const& fields) {
         auto& tag = _tags[tagName];
         tag.source = w;
         tag.field = field;
+        tag.maxAge = -1;
         tag.quality = Quality::CommFail;
+        if (!tag.subscribers.empty() || _perTag.contains(tagName)) {
+            demand(tag);
+        }
     }
 }
 
 void TagRegistry::Subscribe(QString const& tagName, LuaFunction fn) {
-    _tags[tagName].subscribers.push_back(std::move(fn));
+    auto& tag = _tags[tagName];
+    tag.subscribers.push_back(std::move(fn));
+    demand(tag);
+}
+
+// subscriptions cannot be cancelled, so a tag stays demanded once it has consumers
+void TagRegistry::demand(Tag& tag) {
+    if (tag.source && !tag.demanded) {
+        tag.demanded = true;
+        tag.source->AddDemand(tag.field);
+    }
+}
+
+void TagRegistry::Share(QString const& name, uint32_t slots) {
+    if (_shm) {
+        Raise("tags are already shared as '{}'", _shm->Name());
+    }
+    _shm = std::make_unique<TagShm>(_inst, name, slots);
+    for (auto it = _tags.begin(); it != _tags.end(); ++it) {
+        auto& tag = it.value();
+        _shm->Publish(it.key(), tag.shmSlot, tag.value, tag.ts, uint8_t(tag.quality));
+    }
+    _inst->Info("tags", "sharing tag table as '{}' ({} slots)", name, slots);
 }
 
 TagRegistry::Tag const* TagRegistry::GetTag(QString const& tagName) const {
@@ -124,6 +158,11 @@ void TagRegistry::setWorkerQuality(Worker* w, Quality q) {
         auto& tag = it.value();
         if (tag.quality == q) continue;
         tag.quality = q;
+        if (q == Quality::Good) {
+            touchAge(it.key(), tag);
+        } else if (tag.ageTimer != NoAgeTimer) {
+            _ages.Disarm(tag.ageTimer);
+        }
         notifyTag(it.key(), tag);
     }
 }
@@ -133,14 +172,92 @@ void TagRegistry::updateTag(QString const& tagName, QVariant const& value, Worke
     if (!tag.source) {
         tag.source = source;
         tag.field = tagName.mid(source->objectName().size() + 1);
+        tag.maxAge = -1;
     }
     tag.value = value;
     tag.ts = QDateTime::currentMSecsSinceEpoch();
     tag.quality = Quality::Good;
+    touchAge(tagName, tag);
     notifyTag(tagName, tag);
 }
 
-void TagRegistry::notifyTag(QString const& tagName, Tag const& tag) {
+// per-worker limits go by the tag's source: worker names may contain ':' themselves
+qint64 TagRegistry::resolveMaxAge(QString const& tagName, Tag const& tag) const {
+    if (_maxAge.isEmpty()) return 0;
+    auto it = _maxAge.find(tagName);
+    if (it != _maxAge.end()) return it.value();
+    if (!tag.source) return 0;
+    return _maxAge.value(tag.source->objectName(), 0);
+}
+
+void TagRegistry::touchAge(QString const& tagName, Tag& tag) {
+    if (tag.maxAge < 0) {
+        tag.maxAge = resolveMaxAge(tagName, tag);
+    }
+    if (!tag.maxAge) {
+        if (tag.ageTimer != NoAgeTimer) {
+            _ages.Disarm(tag.ageTimer);
+        }
+        return;
+    }
+    if (tag.ageTimer == NoAgeTimer) {
+        tag.ageTimer = _ages.Add(tagName);
+    }
+    auto now = uint64_t(_clock.elapsed() / AgeTickMs);
+    auto ticks = uint64_t((tag.maxAge + AgeTickMs - 1) / AgeTickMs);
+    _ages.Arm(tag.ageTimer, now + ticks);
+}
+
+void TagRegistry::SetMaxAge(QString const& target, qint64 ms) {
+    if (ms < 0) {
+        Raise("tags:max_age(): negative age for '{}'", target);
+    }
+    if (ms) {
+        _maxAge[target] = ms;
+    } else {
+        _maxAge.remove(target);
+    }
+    if (!_ageTick) {
+        _ageTick = new QTimer(this);
+        _ageTick->setInterval(int(AgeTickMs));
+        _ageTick->callOnTimeout(this, &TagRegistry::onAgeTick);
+    }
+    if (!_maxAge.isEmpty() && !_ageTick->isActive()) {
+        onAgeTick(); // nothing is armed while stopped: catches the wheel up to the clock
+        _ageTick->start();
+    }
+    // re-resolved on the next update, or right away for tags that are up to date
+    for (auto it = _tags.begin(); it != _tags.end(); ++it) {
+        auto& tag = it.value();
+        if (it.key() != target && !(tag.source && tag.source->objectName() == target)) continue;
+        tag.maxAge = -1;
+        if (tag.quality == Quality::Good) {
+            touchAge(it.key(), tag);
+        }
+    }
+    // no limits left: every armed timer was disarmed above
+    if (_maxAge.isEmpty()) {
+        _ageTick->stop();
+    }
+}
+
+void TagRegistry::onAgeTick() {
+    auto now = uint64_t(_clock.elapsed() / AgeTickMs);
+    _ages.Advance(now, [this](TimerWheel<QString>::Id, QString const& tagName) {
+        auto it = _tags.find(tagName);
+        if (it == _tags.end()) return;
+        auto& tag = it.value();
+        if (tag.quality != Quality::Good) return;
+        tag.quality = Quality::Stale;
+        notifyTag(tagName, tag);
+    });
+}
+
+void TagRegistry::notifyTag(QString const& tagName, Tag& tag) {
+    if (_shm) {
+        _shm->Publish(tagName, tag.shmSlot, tag.value, tag.ts, uint8_t(tag.quality));
+    }
+
     QVariantMap ev;
     ev["name"] = tagName;
     ev["value"] = tag.value;
@@ -168,6 +285,9 @@ void TagRegistry::notifyTag(QString const& tagName, Tag const& tag) {
 LuaValue& TagRegistry::PerTagListeners(QString const& tagName) {
     auto it = _perTag.find(tagName);
     if (it != _perTag.end()) return it.value();
+    if (auto tag = _tags.find(tagName); tag != _tags.end()) {
+        demand(tag.value());
+    }
     auto* L = _inst->LuaState();
     lua_newtable(L);
     return _perTag.insert(tagName, LuaValue(L, ConsumeTop)).value();
@@ -196,6 +316,32 @@ static int tags_subscribe(lua_State* L) {
     return 0;
 }
 
+static int tags_share(lua_State* L) {
+    auto* reg = getRegistry(L);
+    auto name = QString::fromUtf8(luaL_checkstring(L, 2));
+    auto slots = luaL_optinteger(L, 3, 4096);
+    if (slots <= 0 || slots > (1 << 24)) {
+        Raise("tags:share(): invalid slot count: {}", slots);
+    }
+    reg->Share(name, uint32_t(slots));
+    return 0;
+}
+
+static int tags_max_age(lua_State* L) {
+    auto* reg = getRegistry(L);
+    // args: [1]=self (ignored), [2]=tag name | worker name | worker, [3]=ms
+    QString target;
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        target = QString::fromUtf8(lua_tostring(L, 2));
+    } else if (auto* w = builtin::help::toQVar(L, 2).value<Worker*>()) {
+        target = w->objectName();
+    } else {
+        Raise("tags:max_age(): tag name, worker name or worker expected");
+    }
+    reg->SetMaxAge(target, qint64(luaL_checkinteger(L, 3)));
+    return 0;
+}
+
 static int tags_get(lua_State* L) {
     auto* reg = getRegistry(L);
     auto name = QString::fromUtf8(luaL_checkstring(L, 2));
@@ -262,6 +408,14 @@ void Instance::EnableTags() {
     lua_pushcclosure(L, glua::protect<tags_source>, 1);
     lua_setfield(L, -2, "source");
 
+    lua_pushlightuserdata(L, reg);
+    lua_pushcclosure(L, glua::protect<tags_share>, 1);
+    lua_setfield(L, -2, "share");
+
+    lua_pushlightuserdata(L, reg);
+    lua_pushcclosure(L, glua::protect<tags_max_age>, 1);
+    lua_setfield(L, -2, "max_age");
+
     reg->changedObj.Push(L);
     lua_setfield(L, -2, "changed");
 
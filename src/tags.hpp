@@ -1,17 +1,31 @@
 #pragma once
 #include "radapter/radapter.hpp"
 #include "radapter/function.hpp"
+#include "tag_shm.hpp"
+#include "timer_wheel.hpp"
+#include <QElapsedTimer>
+#include <memory>
 #include <vector>
 
+class QTimer;
+
 namespace radapter {
 
 class TagRegistry : public QObject {
     Q_OBJECT
 public:
-    enum class Quality : uint8_t { Good, CommFail };
+    enum class Quality : uint8_t { Good, CommFail, Stale };
     static constexpr const char* qualityStr(Quality q) noexcept {
-        return q == Quality::Good ? "good" : "comm_fail";
+        switch (q) {
+        case Quality::Good: return "good";
+        case Quality::CommFail: return "comm_fail";
+        case Quality::Stale: return "stale";
+        }
+        return "comm_fail";
     }
+    // staleness is checked with this granularity
+    static constexpr qint64 AgeTickMs = 100;
+    static constexpr uint32_t NoAgeTimer = UINT32_MAX;
 
     struct Tag {
         QVariant value;
@@ -20,6 +34,10 @@ public:
         QPointer<Worker> source;
         QString field;
         std::vector<LuaFunction> subscribers;
+        int shmSlot = -1; // see TagShm::Publish
+        qint64 maxAge = -1; // ms, 0 = never stale, -1 = not resolved yet
+        uint32_t ageTimer = NoAgeTimer;
+        bool demanded = false; // source was told about consumers, see Worker::AddDemand
     };
 
     LuaValue changedListeners;
@@ -31,6 +49,12 @@ public:
     Tag const* GetTag(QString const& tagName) const;
     QStringList TagNames() const { return _tags.keys(); }
     void Advertise(Worker* w, QStringList const& fields);
+    // publish current values into a shared-memory table for external readers
+    void Share(QString const& name, uint32_t slots);
+    // mark tags `stale` when not updated for `ms` (0 disables). `target` is either
+    // a tag name ("worker:field") or a worker name, which covers all its tags;
+    // a per-tag limit wins over the per-worker one
+    void SetMaxAge(QString const& target, qint64 ms);
 
     // get-or-create the per-tag listener list behind tags.changed["name"]
     LuaValue& PerTagListeners(QString const& tagName);
@@ -48,11 +72,20 @@ public slots:
 private:
     void setWorkerQuality(Worker* w, Quality q);
     void updateTag(QString const& tagName, QVariant const& value, Worker* source);
-    void notifyTag(QString const& tagName, Tag const& tag);
+    void notifyTag(QString const& tagName, Tag& tag);
+    void demand(Tag& tag);
+    qint64 resolveMaxAge(QString const& tagName, Tag const& tag) const;
+    void touchAge(QString const& tagName, Tag& tag);
+    void onAgeTick();
 
     Instance* _inst;
     QMap<QString, Tag> _tags;
     QMap<QString, LuaValue> _perTag; // per-tag changed-listener lists
+    std::unique_ptr<TagShm> _shm;
+    QMap<QString, qint64> _maxAge; // by tag or worker name, see SetMaxAge
+    TimerWheel<QString> _ages;
+    QElapsedTimer _clock;
+    QTimer* _ageTick = nullptr;
 };
 
 } // namespace radapter
@@ -0,0 +1,143 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace radapter {
+
+// Hierarchical timer wheel: Levels x 64 slots, level N spans 64^(N+1) ticks.
+// Arm() is O(1) and deadlines are re-checked lazily when a slot fires, so pushing
+// a deadline further out (the common "value updated again" case) never touches the
+// wheel. Moving a deadline earlier re-queues the entry and the old queue position
+// is discarded by its generation. Entries are never freed: ids are dense indices.
+template<typename T>
+class TimerWheel {
+public:
+    using Id = uint32_t;
+    static constexpr unsigned Bits = 6;
+    static constexpr unsigned Slots = 1u << Bits;
+    static constexpr unsigned Levels = 4;
+    static constexpr uint64_t Range = uint64_t(1) << (Bits * Levels);
+
+    Id Add(T payload) {
+        _entries.push_back(Entry{std::move(payload)});
+        return Id(_entries.size() - 1);
+    }
+    T const& Payload(Id id) const { return _entries[id].payload; }
+    uint64_t Now() const noexcept { return _now; }
+    size_t Armed() const noexcept { return _armed; }
+
+    void Arm(Id id, uint64_t deadline) {
+        auto& e = _entries[id];
+        if (deadline <= _now) deadline = _now + 1;
+        if (!e.armed) {
+            e.armed = true;
+            ++_armed;
+        }
+        e.deadline = deadline;
+        if (!e.queued || e.epoch != _epoch || deadline < e.queuedFor) {
+            insert(id);
+        }
+    }
+
+    void Disarm(Id id) {
+        auto& e = _entries[id];
+        if (e.armed) {
+            e.armed = false;
+            --_armed;
+        }
+    }
+
+    // advance to `tick`, calling onExpire(id, payload) for every deadline reached
+    template<typename F>
+    void Advance(uint64_t tick, F&& onExpire) {
+        if (!_armed) {
+            jump(tick);
+            return;
+        }
+        while (_now < tick) {
+            ++_now;
+            for (unsigned lvl = 1; lvl < Levels; ++lvl) {
+                if (_now & ((uint64_t(1) << (Bits * lvl)) - 1)) break;
+                cascade(lvl, unsigned(_now >> (Bits * lvl)) & (Slots - 1));
+            }
+            auto fired = std::move(_wheel[0][_now & (Slots - 1)]);
+            _wheel[0][_now & (Slots - 1)].clear();
+            for (auto& q: fired) {
+                auto& e = _entries[q.id];
+                if (q.gen != e.gen) continue;
+                e.queued = false;
+                if (!e.armed) continue;
+                if (e.deadline > _now) {
+                    insert(q.id);
+                    continue;
+                }
+                e.armed = false;
+                --_armed;
+                T payload = e.payload; // callback may Add() and reallocate entries
+                onExpire(q.id, payload);
+            }
+            if (!_armed) {
+                jump(tick);
+                break;
+            }
+        }
+    }
+private:
+    struct Queued {
+        Id id;
+        uint32_t gen;
+    };
+    struct Entry {
+        T payload;
+        uint64_t deadline = 0;
+        uint64_t queuedFor = 0;
+        uint32_t gen = 0;
+        uint32_t epoch = 0;
+        bool armed = false;
+        bool queued = false;
+    };
+
+    void insert(Id id) {
+        auto& e = _entries[id];
+        auto delta = e.deadline - _now;
+        auto at = delta < Range ? e.deadline : _now + Range - 1; // re-checked when it fires
+        unsigned lvl = 0;
+        while (lvl + 1 < Levels && (at - _now) >= (uint64_t(1) << (Bits * (lvl + 1)))) {
+            ++lvl;
+        }
+        e.gen++;
+        e.epoch = _epoch;
+        e.queued = true;
+        e.queuedFor = at;
+        _wheel[lvl][unsigned(at >> (Bits * lvl)) & (Slots - 1)].push_back({id, e.gen});
+    }
+
+    // skipping ticks skips cascades too, so queue positions taken before the jump
+    // can no longer be trusted; only allowed while nothing is armed
+    void jump(uint64_t tick) {
+        if (tick <= _now) return;
+        _now = tick;
+        _epoch++;
+    }
+
+    void cascade(unsigned lvl, unsigned slot) {
+        auto moved = std::move(_wheel[lvl][slot]);
+        _wheel[lvl][slot].clear();
+        for (auto& q: moved) {
+            auto& e = _entries[q.id];
+            if (q.gen != e.gen) continue;
+            e.queued = false;
+            if (e.armed) insert(q.id);
+        }
+    }
+
+    uint64_t _now = 0;
+    uint32_t _epoch = 0;
+    size_t _armed = 0;
+    std::vector<Entry> _entries;
+    std::array<std::array<std::vector<Queued>, Slots>, Levels> _wheel;
+};
+
+}
@@ -100,6 +100,21 @@ void Worker::AdvertiseFields(QStringList const& fields) {
     }
 }
 
+void Worker::AddDemand(QString const& field) {
+    if (_Demand[field]++ == 0) {
+        OnDemandChanged();
+    }
+}
+
+void Worker::RemoveDemand(QString const& field) {
+    auto it = _Demand.find(field);
+    if (it == _Demand.end()) return;
+    if (--it.value() == 0) {
+        _Demand.erase(it);
+        OnDemandChanged();
+    }
+}
+
 void Worker::Log(LogLevel lvl, fmt::string_view fmt, fmt::format_args args)
 {
     _Inst->Log(lvl, _LogCat.c_str(), fmt, args);
@@ -181,6 +196,23 @@ static int worker_shutdown(lua_State* L) {
     return 1;
 }
 
+// worker:want(field) / worker:unwant(field), see Worker::AddDemand()
+static int worker_want(lua_State* L) {
+    auto* cls = lua_tostring(L, lua_upvalueindex(1));
+    auto* ud = static_cast<WorkerImpl*>(luaL_checkudata(L, 1, cls));
+    auto w = ud->self.data();
+    if (!w) {
+        Raise("worker not usable");
+    }
+    auto field = QString::fromUtf8(luaL_checkstring(L, 2));
+    if (lua_toboolean(L, lua_upvalueindex(2))) {
+        w->AddDemand(field);
+    } else {
+        w->RemoveDemand(field);
+    }
+    return 0;
+}
+
 static int worker_call(lua_State* L) {
     auto* cls = lua_tostring(L, lua_upvalueindex(1));
     auto* ud = static_cast<WorkerImpl*>(luaL_checkudata(L, 1, cls));
@@ -344,6 +376,16 @@ static void push_worker(lua_State* L, Instance* inst, const char* clsname, Worke
         lua_pushcclosure(L, glua::protect<get_listeners>, 1);
         lua_setfield(L, -2, "get_listeners");
 
+        lua_pushvalue(L, clsIdx);
+        lua_pushboolean(L, true);
+        lua_pushcclosure(L, glua::protect<worker_want>, 2);
+        lua_setfield(L, -2, "want");
+
+        lua_pushvalue(L, clsIdx);
+        lua_pushboolean(L, false);
+        lua_pushcclosure(L, glua::protect<worker_want>, 2);
+        lua_setfield(L, -2, "unwant");
+
         lua_pushvalue(L, clsIdx);
         lua_pushcclosure(L, glua::protect<worker_call>, 1);
         lua_pushvalue(L, -1);
@@ -1,4 +1,5 @@
 #include "modbus_device.hpp"
+#include <set>
 
 #ifdef __GNUC__
 #pragma GCC diagnostic ignored "-Wnull-dereference"
@@ -12,14 +13,47 @@ class Master : public Worker
     Q_OBJECT
 public:
     MasterConfig config;
-    PreparedReads reads;
+    //! own read plan and timer per scan class, so slow registers do not eat the bandwidth of fast ones
+    struct PollGroup {
+        string name;
+        unsigned rate{};
+        //! shared with pending read callbacks, replaced as a whole on replan()
+        std::shared_ptr<PreparedReads> reads = std::make_shared<PreparedReads>();
+        QTimer* timer{};
+        unsigned pending{}; // requests of the current cycle not answered yet
+        quint64 cycles{};
+        quint64 overruns{}; // cycles skipped because the previous one was still pending
+    };
+    //! not resized after construction: read callbacks keep pointers into it
+    vector<PollGroup> groups;
     PreparedWrites writable;
-    struct InFlight {
-        QModbusDataUnit unit;
+    struct PendingWrite {
+        const PreparedWriteRegister* reg{};
+        string key; // reg->key, or "key:[N]" for a single block element
+        int index{};
+        QVector<uint16_t> words;
+        QVariant v; // echoed back once written, write-only registers only
         unsigned retriesLeft{};
     };
-    std::unordered_map<string, InFlight> inFlight;
-    QMap<string, QVariant> currentState;
+    using WriteKey = std::pair<QModbusDataUnit::RegisterType, int>;
+    //! writes not sent yet, sorted by address so neighbours merge into one FC15/FC16 request.
+    //! A newer value replaces the queued one (last value wins)
+    std::map<WriteKey, PendingWrite> pendingWrites;
+    //! at most one write request of this master is queued or in flight, so two values of
+    //! one register never race over pipelined transactions or parallel connections.
+    //! Its unit is built from `pendingWrites` only when the device is ready to send it
+    bool writeQueued = false;
+    //! last raw words and pre-split output path of every polled register
+    struct StateSlot {
+        KeyPath path;
+        uint32_t raw{}; // offset into rawState
+        bool valid = false;
+    };
+    vector<StateSlot> state;
+    vector<uint16_t> rawState; // last raw words of every slot
+    std::unordered_map<string, uint32_t> slots; // register key -> index into state
+    bool replanQueued = false;
+
     Master(MasterConfig conf, Instance* parent) :
         Worker(parent,
                EnsureName(conf, QString("%1/slave:%2")
@@ -28,41 +62,217 @@ public:
                "modbus")
     {
         config = std::move(conf);
-        validateRegisters(config.registers);
-        if (config.queries) {
-            reads = prepareManualReads(config.registers, *config.queries);
-        } else {
-            reads = prepareReads(config.registers);
+        if (!config.weight) {
+            Raise("weight must be at least 1");
         }
+        config.device->SetWeight(config.slave_id, config.weight);
+        validateRegisters(config.registers);
+        prepareGroups();
+        compilePlans();
         writable = prepareWrites(config.registers);
         if (TagsEnabled()) {
+            // all readable registers, in demand mode most of them are not polled yet
             QStringList fields;
-            for (auto& merged : reads)
-                for (auto& reg : merged.regs)
-                    fields << QString::fromStdString(reg.key);
+            auto& regs = config.registers;
+            for (auto* single: {&regs.holding.value, &regs.coils.value, &regs.di.value, &regs.input.value})
+                for (auto& [k, reg] : *single)
+                    if (reg.mode != write)
+                        fields << QString::fromStdString(k);
             AdvertiseFields(fields);
         }
-        QTimer* poller = new QTimer(this);
-        poller->setInterval(int(config.poll_rate));
-        poller->callOnTimeout(this, &Master::poll);
-        connect(config.device, &MasterDevice::ConnectedChanged, this, [=](bool state){
+        for (auto& group: groups) {
+            group.timer = new QTimer(this);
+            group.timer->setInterval(int(group.rate));
+            group.timer->callOnTimeout(this, [this, g = &group]{
+                poll(*g);
+            });
+        }
+        connect(config.device, &MasterDevice::ConnectedChanged, this, &Master::onConnectedChanged);
+        if (config.device->IsConnected()) {
+            // a device shared with earlier masters: deferred, so the event can be listened to
+            QTimer::singleShot(0, this, [this]{
+                onConnectedChanged(config.device->IsConnected());
+            });
+        }
+        config.device->Start();
+    }
+    void onConnectedChanged(bool state) {
+        for (auto& group: groups) {
             if (state) {
-                poller->start();
-                emit SendEvent(QVariantMap{{"state", "ConnectedState"}});
+                group.timer->start();
             } else {
-                poller->stop();
-                emit SendEvent(QVariantMap{{"state", "UnconnectedState"}});
+                group.timer->stop();
+            }
+        }
+        if (state) {
+            emit SendEvent(QVariantMap{{"state", "ConnectedState"}});
+        } else {
+            emit SendEvent(QVariantMap{{"state", "UnconnectedState"}});
+        }
+    }
+    ReadPlan readPlan() const {
+        ReadPlan plan;
+        plan.max_gap = config.max_gap;
+        plan.max_regs_per_request = config.max_regs_per_request;
+        plan.max_bits_per_request = config.max_bits_per_request;
+        if (!plan.max_regs_per_request || plan.max_regs_per_request > MaxReadRegs) {
+            Raise("max_regs_per_request must be in range 1-{}", MaxReadRegs);
+        }
+        if (!plan.max_bits_per_request || plan.max_bits_per_request > MaxReadBits) {
+            Raise("max_bits_per_request must be in range 1-{}", MaxReadBits);
+        }
+        return plan;
+    }
+    void prepareGroups() {
+        map<string, unsigned> rates;
+        if (config.poll_groups) {
+            rates = *config.poll_groups;
+        }
+        rates.try_emplace(DefaultPollGroup, config.poll_rate.value);
+        auto& regs = config.registers;
+        for (auto* single: {&regs.holding.value, &regs.coils.value, &regs.di.value, &regs.input.value}) {
+            for (auto& [k, reg]: *single) {
+                if (!rates.count(groupOf(reg))) {
+                    Raise("Register {}: unknown poll group '{}'", k, groupOf(reg));
+                }
+                if (reg.group && config.queries) {
+                    Raise("Register {}: poll groups cannot be used together with manual 'queries'", k);
+                }
+            }
+        }
+        if (config.queries) {
+            if (config.poll_on_demand) {
+                Raise("poll_on_demand cannot be used together with manual 'queries'");
             }
+            groups.push_back({DefaultPollGroup, rates[DefaultPollGroup],
+                              std::make_shared<PreparedReads>(prepareManualReads(regs, *config.queries))});
+            return;
+        }
+        auto plan = readPlan();
+        for (auto& [name, rate]: rates) {
+            if (!rate) {
+                Raise("poll group '{}': poll rate must be positive", name);
+            }
+            // in demand mode groups start empty and are filled by replan()
+            if (config.poll_on_demand) {
+                groups.push_back({name, rate});
+                continue;
+            }
+            auto reads = prepareReads(filterGroup(regs, name), plan);
+            if (reads.empty()) continue;
+            groups.push_back({name, rate, std::make_shared<PreparedReads>(std::move(reads))});
+        }
+    }
+    //! register `key` is read if a consumer wants it, one of its parents ("obj" for "obj:x"),
+    //! or one of its children
+    bool isDemanded(string const& key) const {
+        auto k = QString::fromStdString(key);
+        for (auto it = _Demand.cbegin(); it != _Demand.cend(); ++it) {
+            auto& want = it.key();
+            if (k == want
+                || (k.startsWith(want) && k.at(want.size()) == ':')
+                || (want.startsWith(k) && want.at(k.size()) == ':'))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    void OnDemandChanged() override {
+        if (!config.poll_on_demand || replanQueued) return;
+        replanQueued = true;
+        QTimer::singleShot(0, this, [this]{
+            replanQueued = false;
+            replan();
         });
-        config.device->Start();
     }
-    void poll() {
-        for (auto& merged: reads) {
+    void replan() {
+        std::set<string> before;
+        for (auto& group: groups)
+            for (auto& merged: *group.reads)
+                for (auto& reg: merged.regs)
+                    before.insert(reg.key);
+        auto plan = readPlan();
+        size_t polled = 0;
+        for (auto& group: groups) {
+            auto regs = filterGroup(config.registers, group.name);
+            for (auto* single: {&regs.holding.value, &regs.coils.value, &regs.di.value, &regs.input.value}) {
+                for (auto it = single->begin(); it != single->end();) {
+                    if (isDemanded(it->first)) {
+                        ++it;
+                    } else {
+                        it = single->erase(it);
+                    }
+                }
+                polled += single->size();
+            }
+            group.reads = std::make_shared<PreparedReads>(prepareReads(regs, plan));
+        }
+        compilePlans();
+        // newly polled registers are reported on the first reply, even if unchanged since last time
+        for (auto& group: groups)
+            for (auto& merged: *group.reads)
+                for (auto& reg: merged.regs)
+                    if (!before.count(reg.key))
+                        state[slots.at(reg.key)].valid = false;
+        Debug("poll on demand: {} registers polled", polled);
+    }
+    void compilePlans() {
+        auto slotOf = [&](PreparedRegister const& reg) {
+            auto [it, added] = slots.try_emplace(reg.key, uint32_t(state.size()));
+            if (added) {
+                state.push_back({compileKeyPath(reg.key), uint32_t(rawState.size())});
+                rawState.resize(rawState.size() + size_t(reg.sizeOf / 2));
+            }
+            return it->second;
+        };
+        for (auto& group: groups) {
+            for (auto& merged: *group.reads) {
+                compileDecodePlan(merged, slotOf);
+            }
+        }
+    }
+    QVariantMap Stats() {
+        QVariantMap result;
+        for (auto& group: groups) {
+            result[QString::fromStdString(group.name)] = QVariantMap{
+                {"rate", group.rate},
+                {"requests", requestsOf(*group.reads)},
+                {"pending", group.pending},
+                {"cycles", group.cycles},
+                {"overruns", group.overruns},
+            };
+        }
+        return result;
+    }
+    QVariantMap SlaveStats() {
+        return config.device->SlaveStats(config.slave_id);
+    }
+    void poll(PollGroup& group) {
+        if (group.pending) {
+            group.overruns++;
+            Debug("poll group '{}': {} requests of the previous cycle still pending, skipping (overruns: {})",
+                  group.name, group.pending, group.overruns);
+            return;
+        }
+        if (group.reads->empty()) {
+            return;
+        }
+        group.cycles++;
+        group.pending = requestsOf(*group.reads);
+        for (auto& merged: *group.reads) {
+            if (merged.chunk) {
+                pollChunked(group, merged);
+                continue;
+            }
             Request req;
             req.slave_id = config.slave_id;
             req.unit = merged.unit;
             req.ctx = this;
-            req.cb = [this, src = &merged](QModbusDataUnit result, std::exception_ptr except){
+            req.cb = [this, g = &group, reads = group.reads, src = &merged](QModbusDataUnit result, std::exception_ptr except){
+                if (g->pending) {
+                    g->pending--;
+                }
                 if (except) {
                     try {
                         std::rethrow_exception(except);
@@ -76,25 +286,82 @@ public:
             config.device->Execute(MasterDevice::op_read, std::move(req));
         }
     }
-    void parsePoll(MergedRead const& read, QModbusDataUnit const& resp) {
-        uint16_t data[2];
-        FlatMap diff;
-        for (auto& reg: read.regs) {
-            data[0] = resp.value(reg.index - resp.startAddress());
-            if (reg.sizeOf == 4) {
-                data[1] = resp.value(reg.index + 1 - resp.startAddress());
+    //! pieces of a register longer than one PDU, decoded once all of them arrived
+    void pollChunked(PollGroup& group, MergedRead& merged) {
+        struct Assembly {
+            QModbusDataUnit unit;
+            unsigned left;
+            bool failed = false;
+        };
+        auto total = int(merged.unit.valueCount());
+        auto chunk = int(merged.chunk);
+        auto whole = std::make_shared<Assembly>(Assembly{
+            QModbusDataUnit(merged.unit.registerType(), merged.unit.startAddress(), quint16(total)),
+            requestsOf(merged)});
+        for (int offset = 0; offset < total; offset += chunk) {
+            Request req;
+            req.slave_id = config.slave_id;
+            req.unit = QModbusDataUnit(merged.unit.registerType(),
+                                       merged.unit.startAddress() + offset,
+                                       quint16((std::min)(chunk, total - offset)));
+            req.ctx = this;
+            req.cb = [this, g = &group, reads = group.reads, src = &merged, whole](QModbusDataUnit result, std::exception_ptr except){
+                if (g->pending) {
+                    g->pending--;
+                }
+                whole->left--;
+                if (except) {
+                    try {
+                        std::rethrow_exception(except);
+                    } catch (std::exception& e) {
+                        if (!whole->failed) {
+                            Error("Error reading '{}': {}", src->regs.front().key, e.what());
+                        }
+                    }
+                    whole->failed = true;
+                    return;
+                }
+                auto at = result.startAddress() - whole->unit.startAddress();
+                auto count = int(result.valueCount());
+                for (int i = 0; i < count && at + i < int(whole->unit.valueCount()); ++i) {
+                    whole->unit.setValue(at + i, result.value(i));
+                }
+                if (!whole->left && !whole->failed) {
+                    parsePoll(*src, whole->unit);
+                }
+            };
+            config.device->Execute(MasterDevice::op_read, std::move(req));
+        }
+    }
+    void parsePoll(MergedRead& read, QModbusDataUnit const& resp) {
+        auto values = resp.values();
+        if (values == read.lastReply) {
+            return;
+        }
+        auto base = read.unit.startAddress() - resp.startAddress();
+        QVariant diff;
+        QVarLengthArray<uint16_t, 4> words;
+        for (auto& step: read.plan) {
+            auto at = base + step.offset;
+            if (at < 0 || at + step.words > values.size()) {
+                continue;
             }
-            auto asVariant = decodeRegister(reg, data);
-            auto& current = currentState[reg.key];
-            if (current != asVariant) {
-                current = std::move(asVariant);
-                diff.push_back({reg.key, current});
+            auto* src = values.constData() + at;
+            auto& slot = state[step.slot];
+            auto* last = rawState.data() + slot.raw;
+            if (slot.valid && std::equal(src, src + step.words, last)) {
+                continue;
             }
+            slot.valid = true;
+            std::copy(src, src + step.words, last);
+            words.resize(step.words);
+            std::copy(src, src + step.words, words.data());
+            unpackWords(words.data(), step.words, step.elemWords, {step.byteSwap, step.wordSwap});
+            insertPath(diff, slot.path, decodeWords(step.type, step.count, step.asBytes, words.data()));
         }
-        if (!diff.empty()) {
-            QVariant unflat;
-            Unflatten(unflat, diff);
-            emit SendMsg(unflat);
+        read.lastReply = std::move(values);
+        if (diff.isValid()) {
+            emit SendMsg(diff);
         }
     }
     void OnMsg(QVariant const& msg) override {
@@ -102,9 +369,10 @@ public:
         Flatten(flat, msg);
         for (auto& [k, v]: flat) {
             if (!v.isValid()) continue;
-            auto it = writable.find(k);
-            if (it == writable.end()) continue; //warn?
-            auto& reg = it->second;
+            int element;
+            auto* found = findWritable(writable, k, element);
+            if (!found) continue; //warn?
+            auto& reg = *found;
             if (reg.validator) {
                 try {
                     auto res = reg.validator->Call({});
@@ -118,59 +386,107 @@ public:
                 }
             }
             QVector<uint16_t> words;
-            if (!encodeRegister(reg, v, words)) {
+            bool encoded = element < 0
+                               ? encodeRegister(reg, v, words)
+                               : encodeValue(reg.type, reg.packing, v, words);
+            if (!encoded) {
                 Warn("could not encode '{}' <= {}", k, v.toString());
                 continue;
             }
-            QModbusDataUnit unit;
-            unit.setRegisterType(reg.mbType);
-            unit.setStartAddress(reg.index);
-            unit.setValues(words);
-            inFlight[k] = {unit, config.write_retries};
-            write(std::move(unit), &reg, std::move(v));
+            auto index = element < 0 ? reg.index : reg.index + element * getSizeOf(reg.type) / 2;
+            pendingWrites[{reg.mbType, index}] = {
+                &reg, k, index, std::move(words), reg.writeOnly ? std::move(v) : QVariant{}, config.write_retries
+            };
         }
+        queueWrites();
     }
-    void write(QModbusDataUnit const& unit, const PreparedWriteRegister* reg, QVariant v) {
+    void queueWrites() {
+        if (writeQueued || pendingWrites.empty()) return;
+        writeQueued = true;
         Request req;
-        req.unit = unit;
         req.ctx = this;
         req.slave_id = config.slave_id;
-        req.cb = [this, reg, v = reg->writeOnly ? std::move(v) : QVariant{}](QModbusDataUnit, std::exception_ptr except) mutable {
-            if (except) {
-                try {
-                    std::rethrow_exception(except);
-                } catch (std::exception& e) {
-                    Warn("error writing '{}': {}", reg->key, e.what());
-                    retry(reg, std::move(v));
-                }
-            } else {
-                ok(reg, std::move(v));
+        req.prepare = [this](Request& self){
+            return takeWrites(self);
+        };
+        req.cb = [this](QModbusDataUnit, std::exception_ptr except){
+            // only reached if dropped from the queue before being prepared
+            writeQueued = false;
+            try {
+                std::rethrow_exception(except);
+            } catch (std::exception& e) {
+                Warn("{} pending writes wait for the next message: {}", pendingWrites.size(), e.what());
             }
         };
         config.device->Execute(MasterDevice::op_write, std::move(req));
     }
-    void retry(const PreparedWriteRegister* reg, QVariant v) {
-        Info("retrying '{}'", reg->key);
-        auto it = inFlight.find(reg->key);
-        if (it == inFlight.end()) {
-            Error("inflight record for '{}' lost", reg->key);
-            return;
+    bool takeWrites(Request& req) {
+        if (pendingWrites.empty()) {
+            writeQueued = false;
+            return false;
+        }
+        auto it = pendingWrites.begin();
+        auto type = it->first.first;
+        auto start = it->first.second;
+        auto next = start;
+        auto limit = qsizetype(type == QModbusDataUnit::Coils ? MaxWriteBits : MaxWriteRegs);
+        QVector<uint16_t> words;
+        vector<PendingWrite> batch;
+        while (it != pendingWrites.end()
+               && it->first.first == type
+               && it->first.second == next
+               && words.size() + it->second.words.size() <= limit)
+        {
+            words += it->second.words;
+            next += int(it->second.words.size());
+            batch.push_back(std::move(it->second));
+            it = pendingWrites.erase(it);
         }
-        if (it->second.retriesLeft == 0) {
-            Error("could not write '{}' for {} times",
-                    reg->key, config.write_retries.value);
+        req.unit = QModbusDataUnit(type, start, words);
+        req.cb = [this, batch = std::move(batch)](QModbusDataUnit, std::exception_ptr except) mutable {
+            written(std::move(batch), except);
+        };
+        return true;
+    }
+    // the rest goes with the next request, once this one is answered
+    void written(vector<PendingWrite> batch, std::exception_ptr except) {
+        writeQueued = false;
+        if (!except) {
+            for (auto& w: batch) {
+                ok(w);
+            }
+            queueWrites();
             return;
         }
-        it->second.retriesLeft--;
-        write(it->second.unit, reg, std::move(v));
+        string error;
+        try {
+            std::rethrow_exception(except);
+        } catch (std::exception& e) {
+            error = e.what();
+        }
+        for (auto& w: batch) {
+            Warn("error writing '{}': {}", w.key, error);
+            WriteKey key{w.reg->mbType, w.index};
+            if (pendingWrites.count(key)) {
+                continue; // a newer value is already waiting
+            }
+            if (w.retriesLeft == 0) {
+                Error("could not write '{}' for {} times",
+                        w.key, config.write_retries.value);
+                continue;
+            }
+            Info("retrying '{}'", w.key);
+            w.retriesLeft--;
+            pendingWrites.emplace(key, std::move(w));
+        }
+        queueWrites();
     }
-    void ok(const PreparedWriteRegister* reg, QVariant v) {
-        if (reg->writeOnly) {
+    void ok(PendingWrite& w) {
+        if (w.reg->writeOnly) {
             QVariant diff;
-            Unflatten(diff, {{reg->key, std::move(v)}});
+            Unflatten(diff, {{w.key, std::move(w.v)}});
             emit SendMsg(diff);
         }
-        inFlight.erase(reg->key);
     }
 };
 
@@ -198,7 +514,13 @@ void radapter::builtin::workers::modbus(Instance* inst) {
     inst->RegisterFunc("RtuModbusServer", makeDevice<modbus::SlaveDevice, modbus::RtuDevice>);
     inst->RegisterSchema("RtuModbusServer", SchemaFor<modbus::RtuDevice>);
 
-    inst->RegisterWorker<modbus::Master>("ModbusMaster");
+    inst->RegisterFunc("TcpModbusGateway", makeDevice<modbus::GatewayDevice, modbus::GatewayConfig>);
+    inst->RegisterSchema("TcpModbusGateway", SchemaFor<modbus::GatewayConfig>);
+
+    inst->RegisterWorker<modbus::Master>("ModbusMaster", {
+        {"Stats", AsExtraMethod<&modbus::Master::Stats>},
+        {"SlaveStats", AsExtraMethod<&modbus::Master::SlaveStats>},
+    });
     inst->RegisterSchema("ModbusMaster", SchemaFor<modbus::MasterConfig>);
 
     modbus::RegisterSlave(inst);
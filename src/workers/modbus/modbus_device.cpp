@@ -12,13 +12,13 @@ radapter::modbus::MasterDevice::MasterDevice(RtuDevice config, QObject *parent)
     using Param = QModbusRtuSerialMaster::ConnectionParameter;
     auto dev = new QModbusRtuSerialMaster(this);
     dev->setInterFrameDelay(int(config.frame_gap.value));
-    device = dev;
+    conns.push_back({dev});
     connectionString = config.port;
-    device->setConnectionParameter(Param::SerialBaudRateParameter, config.baud.value);
-    device->setConnectionParameter(Param::SerialDataBitsParameter, config.data_bits.value);
-    device->setConnectionParameter(Param::SerialStopBitsParameter, config.stop_bits.value);
-    device->setConnectionParameter(Param::SerialParityParameter, config.parity.value);
-    device->setConnectionParameter(Param::SerialPortNameParameter, QString::fromStdString(config.port));
+    dev->setConnectionParameter(Param::SerialBaudRateParameter, config.baud.value);
+    dev->setConnectionParameter(Param::SerialDataBitsParameter, config.data_bits.value);
+    dev->setConnectionParameter(Param::SerialStopBitsParameter, config.stop_bits.value);
+    dev->setConnectionParameter(Param::SerialParityParameter, config.parity.value);
+    dev->setConnectionParameter(Param::SerialPortNameParameter, QString::fromStdString(config.port));
     setObjectName(QString::fromStdString(fmt::format("Device({}/{})", connectionString, config.name.value)));
 }
 
@@ -26,11 +26,19 @@ radapter::modbus::MasterDevice::MasterDevice(TcpDevice config, QObject *parent)
     MasterDevice(static_cast<Device&>(config), parent)
 {
     using Param = QModbusTcpClient::ConnectionParameter;
-    auto dev = new QModbusTcpClient(this);
-    device = dev;
+    if (!config.max_in_flight || !config.connections) {
+        Raise("TcpModbusDevice: max_in_flight and connections must be positive");
+    }
+    maxInFlight = config.max_in_flight;
+    pipelined = maxInFlight > 1 || config.connections > 1;
     connectionString = fmt::format("{}:{}", config.host, config.port);
-    device->setConnectionParameter(Param::NetworkAddressParameter, QString::fromStdString(config.host));
-    device->setConnectionParameter(Param::NetworkPortParameter, config.port);
+    for (unsigned i = 0; i < config.connections; ++i) {
+        // QModbusTcpClient matches replies by transaction id, several may be outstanding
+        auto dev = new QModbusTcpClient(this);
+        dev->setConnectionParameter(Param::NetworkAddressParameter, QString::fromStdString(config.host));
+        dev->setConnectionParameter(Param::NetworkPortParameter, config.port);
+        conns.push_back({dev});
+    }
     setObjectName(QString::fromStdString(fmt::format("Device({}/{})", connectionString, config.name.value)));
 }
 
@@ -42,27 +50,50 @@ void radapter::modbus::MasterDevice::Start() {
     reconnect->callOnTimeout(this, &MasterDevice::doConnect);
     frameGap->setInterval(int(config.frame_gap));
     frameGap->callOnTimeout(this, &MasterDevice::nextReq);
-    connect(device, &QModbusClient::stateChanged, this, [this](QModbusClient::State state){
-        if (state == QModbusClient::ConnectedState) {
-            static_cast<Instance*>(parent())->Info("modbus", "{}: connected", objectName());
-            frameGap->start();
-            emit ConnectedChanged(true);
-        } else if (state == QModbusClient::UnconnectedState) {
-            static_cast<Instance*>(parent())->Warn("modbus", "{}: disconnected", objectName());
-            frameGap->stop();
-            reconnect->start();
-            emit ConnectedChanged(false);
-        }
-    });
+    for (auto& conn: conns) {
+        connect(conn.client, &QModbusClient::stateChanged, this, [this, c = &conn](QModbusClient::State state){
+            onStateChanged(*c, state);
+        });
+    }
     doConnect();
 }
 
+void radapter::modbus::MasterDevice::onStateChanged(Connection& conn, QModbusClient::State state) {
+    auto* inst = static_cast<Instance*>(parent());
+    if (state == QModbusClient::ConnectedState && !conn.connected) {
+        conn.connected = true;
+        if (connectedCount++) {
+            nextReq();
+            return;
+        }
+        inst->Info("modbus", "{}: connected", objectName());
+        frameGap->start();
+        emit ConnectedChanged(true);
+    } else if (state == QModbusClient::UnconnectedState) {
+        reconnect->start();
+        if (!conn.connected) {
+            return;
+        }
+        conn.connected = false;
+        if (--connectedCount) {
+            inst->Warn("modbus", "{}: connection lost ({} of {} left)", objectName(), connectedCount, conns.size());
+            return;
+        }
+        inst->Warn("modbus", "{}: disconnected", objectName());
+        frameGap->stop();
+        emit ConnectedChanged(false);
+    }
+}
+
 void radapter::modbus::MasterDevice::Execute(Op op, Request req) {
-    auto& q = op == op_read ? reads : writes;
+    auto& slave = slaves[req.slave_id];
+    auto& q = op == op_read ? slave.reads : slave.writes;
     auto& max = op == op_read ? config.max_read_queue : config.max_write_queue;
     auto& on_over = op == op_read ? config.on_read_overflow : config.on_write_overflow;
     if (q.size() >= int(max)) {
-        static_cast<Instance*>(parent())->Warn("modbus", "{}: {} overflow", objectName(), op_read ? "read" : "write");
+        static_cast<Instance*>(parent())->Warn("modbus", "{}: slave({}) {} overflow",
+                                               objectName(), req.slave_id, op == op_read ? "read" : "write");
+        slave.overflows++;
         if (on_over == pop_first) {
             q.front().cb({}, std::make_exception_ptr(Err("Removed from queue")));
             q.pop_front();
@@ -70,8 +101,118 @@ void radapter::modbus::MasterDevice::Execute(Op op, Request req) {
             q.back().cb({}, std::make_exception_ptr(Err("Removed from queue")));
             q.pop_back();
         }
+        queued--;
     }
     q.push_back(std::move(req));
+    queued++;
+    if (pipelined) {
+        nextReq();
+    }
+}
+
+void radapter::modbus::MasterDevice::SetWeight(int slave_id, unsigned weight) {
+    slaves[slave_id].weight = (std::max)(weight, 1u);
+}
+
+bool radapter::modbus::MasterDevice::pickRequest(Request& out, bool& isRead) {
+    if (!queued) {
+        return false;
+    }
+    auto now = clock.elapsed();
+    for (bool writesPass: {true, false}) {
+        // the slave served last keeps its turn while it has weight left, else the next one
+        auto it = slaves.find(lastServed);
+        bool inTurn = it != slaves.end() && it->second.servedInTurn < it->second.weight;
+        if (!inTurn) {
+            it = slaves.upper_bound(lastServed);
+        }
+        for (size_t i = 0; i < slaves.size(); ++i, ++it) {
+            if (it == slaves.end()) {
+                it = slaves.begin();
+            }
+            auto& [id, slave] = *it;
+            auto& q = writesPass ? slave.writes : slave.reads;
+            if (q.isEmpty() || slave.backoffUntil > now) {
+                continue;
+            }
+            out = q.dequeue();
+            queued--;
+            isRead = !writesPass;
+            slave.servedInTurn = inTurn && i == 0 ? slave.servedInTurn + 1 : 1;
+            lastServed = id;
+            return true;
+        }
+    }
+    return false;
+}
+
+void radapter::modbus::MasterDevice::finished(int slave_id, qint64 sentAtUs, QModbusDevice::Error error) {
+    auto& slave = slaves[slave_id];
+    auto tookUs = clock.nsecsElapsed() / 1000 - sentAtUs;
+    auto now = clock.elapsed();
+    auto took = tookUs / 1000;
+    slave.recentUs[slave.recentCount++ % slave.recentUs.size()] = quint32(tookUs);
+    auto bucket = tookUs > 10 ? std::ceil(8.0 * std::log2(double(tookUs) / 10.0)) : 0.0;
+    slave.latencyHist[(std::min)(size_t(bucket), LatencyBuckets - 1)]++;
+    slave.requests++;
+    slave.lastMs = took;
+    slave.maxMs = (std::max)(slave.maxMs, took);
+    slave.avgMs = slave.requests == 1 ? double(took) : slave.avgMs * 0.9 + double(took) * 0.1;
+    if (error != QModbusDevice::NoError) {
+        slave.errors++;
+    }
+    auto* inst = static_cast<Instance*>(parent());
+    if (error == QModbusDevice::TimeoutError) {
+        slave.timeouts++;
+        auto shift = (std::min)(slave.timeoutsInRow++, 16u);
+        auto backoff = (std::min)(qint64(config.slave_backoff_ms) << shift, qint64(config.max_slave_backoff_ms));
+        slave.backoffUntil = now + backoff;
+        inst->Warn("modbus", "{}: slave({}) timed out {} time(s) in a row, skipping it for {}ms",
+                   objectName(), slave_id, slave.timeoutsInRow, backoff);
+    } else if (slave.timeoutsInRow) {
+        inst->Info("modbus", "{}: slave({}) responds again", objectName(), slave_id);
+        slave.timeoutsInRow = 0;
+        slave.backoffUntil = 0;
+    }
+}
+
+QVariantMap radapter::modbus::MasterDevice::SlaveStats(int slave_id) const {
+    auto it = slaves.find(slave_id);
+    if (it == slaves.end()) {
+        return {};
+    }
+    auto& slave = it->second;
+    auto backoff = slave.backoffUntil - clock.elapsed();
+    auto samples = (std::min)(size_t(slave.recentCount), slave.recentUs.size());
+    std::vector<quint32> sorted(slave.recentUs.begin(), slave.recentUs.begin() + qsizetype(samples));
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double p) {
+        return sorted.empty() ? 0.0 : sorted[size_t(p * double(sorted.size() - 1))] / 1000.0;
+    };
+    QVariantList hist, bounds;
+    hist.reserve(qsizetype(LatencyBuckets));
+    bounds.reserve(qsizetype(LatencyBuckets));
+    for (size_t i = 0; i < LatencyBuckets; ++i) {
+        hist.push_back(slave.latencyHist[i]);
+        bounds.push_back(LatencyBucketUs(i) / 1000.0);
+    }
+    return QVariantMap{
+        {"requests", slave.requests},
+        {"errors", slave.errors},
+        {"timeouts", slave.timeouts},
+        {"last_ms", slave.lastMs},
+        {"max_ms", slave.maxMs},
+        {"avg_ms", slave.avgMs},
+        {"queued_reads", slave.reads.size()},
+        {"queued_writes", slave.writes.size()},
+        {"backoff_ms", backoff > 0 ? backoff : 0},
+        {"overflows", slave.overflows},
+        {"p50_ms", percentile(0.5)},
+        {"p95_ms", percentile(0.95)},
+        {"p99_ms", percentile(0.99)},
+        {"latency_hist", hist},
+        {"latency_bounds_ms", bounds},
+    };
 }
 
 radapter::modbus::MasterDevice::MasterDevice(const Device &conf, QObject *parent) :
@@ -80,44 +221,67 @@ radapter::modbus::MasterDevice::MasterDevice(const Device &conf, QObject *parent
     reconnect(new QTimer(this)),
     config(conf)
 {
+    clock.start();
+}
+
+auto radapter::modbus::MasterDevice::pickConnection() -> Connection* {
+    Connection* best = nullptr;
+    for (auto& conn: conns) {
+        if (!conn.connected || conn.inFlight >= maxInFlight) continue;
+        if (!best || conn.inFlight < best->inFlight) {
+            best = &conn;
+        }
+    }
+    return best;
 }
 
 void radapter::modbus::MasterDevice::nextReq() {
-    if (busy) {
-        return;
+    if (dispatching) {
+        return; // Execute() from prepare(): the loop below picks it up
     }
-    busy = true;
-    bool isRead;
-    Request req;
-    if (writes.size()) {
-        req = writes.dequeue();
-        isRead = false;
-    } else if (reads.size()) {
-        req = reads.dequeue();
-        isRead = true;
-    } else {
-        busy = false;
-        return;
+    dispatching = true;
+    while (queued) {
+        auto* conn = pickConnection();
+        if (!conn) {
+            break;
+        }
+        Request req;
+        bool isRead;
+        if (!pickRequest(req, isRead)) {
+            break; // only backed off slaves have work
+        }
+        if (req.prepare && (!req.ctx || !req.prepare(req))) {
+            continue;
+        }
+        send(*conn, std::move(req), isRead);
+        if (!pipelined) {
+            break;
+        }
     }
+    dispatching = false;
+}
+
+void radapter::modbus::MasterDevice::send(Connection& conn, Request req, bool isRead) {
     auto slave_id = req.slave_id;
     auto ctx = req.ctx;
     auto start = req.unit.startAddress();
     auto len = req.unit.valueCount();
     auto unit = req.unit;
     QModbusReply* reply = isRead
-                              ? device->sendReadRequest(unit, req.slave_id)
-                              : device->sendWriteRequest(unit, req.slave_id);
+                              ? conn.client->sendReadRequest(unit, req.slave_id)
+                              : conn.client->sendWriteRequest(unit, req.slave_id);
     if (!reply) {
-        busy = false;
         req.cb({}, std::make_exception_ptr(Err(
                        "{}: error in slave_id({}), registers({}-{}) => Could not send",
                        objectName(), slave_id,
                        start, unsigned(start) + len - 1)));
         return;
     }
+    conn.inFlight++;
     reply->setParent(this);
-    connect(reply, &QModbusReply::finished, this, [=, cb = std::move(req.cb)]{
-        busy = false;
+    connect(reply, &QModbusReply::finished, this, [=, c = &conn, sentAt = clock.nsecsElapsed() / 1000, cb = std::move(req.cb)]{
+        c->inFlight--;
+        finished(slave_id, sentAt, reply->error());
         if (ctx) {
             if (reply->error()) {
                 cb({}, std::make_exception_ptr(Err(
@@ -150,15 +314,20 @@ void radapter::modbus::MasterDevice::nextReq() {
             }
         }
         reply->deleteLater();
+        if (pipelined) {
+            nextReq();
+        }
     });
 }
 
 void radapter::modbus::MasterDevice::doConnect() {
-    if (device->state() == QModbusClient::ConnectedState) {
-        return;
+    for (auto& conn: conns) {
+        if (conn.client->state() != QModbusClient::UnconnectedState) {
+            continue;
+        }
+        static_cast<Instance*>(parent())->Info("modbus", "{}: connecting...", objectName());
+        conn.client->connectDevice();
     }
-    static_cast<Instance*>(parent())->Info("modbus", "{}: connecting...", objectName());
-    device->connectDevice();
 }
 
 radapter::modbus::SlaveDevice::SlaveDevice(RtuDevice config, QObject *parent) :
@@ -193,7 +362,7 @@ radapter::modbus::SlaveDevice::SlaveDevice(const Device &conf, QObject *parent)
 {
 }
 
-QModbusServer* radapter::modbus::SlaveDevice::Claim(Worker* by) {
+QModbusServer* radapter::modbus::SlaveDevice::Claim(Worker* by, int) {
     if (claimer) {
         Raise("{}: already claimed by '{}' (created at {})",
               objectName(), claimer->objectName(), claimer->_Origin);
@@ -3,15 +3,21 @@
 #include "builtin.hpp"
 #include "modbus_settings.hpp"
 #include <QModbusDevice>
+#include <QModbusPdu>
 #include <QModbusTcpClient>
 #include <QTimer>
 #include <QQueue>
 #include <QPointer>
+#include <QElapsedTimer>
 #include <QtEndian>
 #include <QModbusRtuSerialClient>
+#include <array>
+#include <cmath>
 #include "modbus_units.hpp"
 
 class QModbusServer;
+class QTcpServer;
+class QTcpSocket;
 
 namespace radapter::modbus
 {
@@ -23,24 +29,74 @@ struct Request {
     int slave_id = 0;
     QModbusDataUnit unit;
     Callback cb;
+    //! optional: called right before sending to fill `unit` (and `cb`) with the latest data,
+    //! returning false drops the request. Only `cb` is called if the request is dropped on overflow
+    std::function<bool(Request& self)> prepare;
 };
 
 class MasterDevice : public QObject {
     Q_OBJECT
+public:
+    //! eight buckets per doubling (~9% wide), from 10us up to ~10s
+    static constexpr size_t LatencyBuckets = 160;
+    //! upper bound of bucket `i`
+    static double LatencyBucketUs(size_t i) {
+        return 10.0 * std::exp2(double(i) / 8.0);
+    }
+private:
+
+    struct Connection {
+        QModbusClient* client = nullptr;
+        unsigned inFlight = 0;
+        bool connected = false;
+    };
 
     bool started = false;
-    bool busy = false;
+    //! TCP with several transactions or connections: dispatch as soon as there is room,
+    //! otherwise (and always for RTU) one request at a time, one per frame gap
+    bool pipelined = false;
+    unsigned maxInFlight = 1;
+    unsigned connectedCount = 0;
+    bool dispatching = false;
     QTimer* frameGap = nullptr;
     QTimer* reconnect = nullptr;
-    QModbusClient* device = nullptr;
-    QQueue<Request> reads;
-    QQueue<Request> writes;
+    //! RTU: exactly one; not resized after construction
+    vector<Connection> conns;
+    //! every slave on the bus gets its own queues, slaves are served round-robin
+    //! (writes of all slaves before reads) and the ones that keep timing out are backed off.
+    //! A slave's turn lasts up to `weight` requests
+    struct SlaveQueue {
+        QQueue<Request> reads;
+        QQueue<Request> writes;
+        unsigned weight = 1;
+        unsigned servedInTurn = 0;
+        unsigned timeoutsInRow = 0;
+        qint64 backoffUntil = 0; // clock ms
+        quint64 requests = 0;
+        quint64 errors = 0;
+        quint64 timeouts = 0;
+        qint64 lastMs = 0;
+        qint64 maxMs = 0;
+        double avgMs = 0;
+        quint64 overflows = 0; // requests dropped from a full queue
+        //! latencies of the last requests, for percentiles
+        std::array<quint32, 512> recentUs{};
+        quint64 recentCount = 0;
+        //! all latencies since start, see LatencyBucketUs(). Two snapshots give exact
+        //! bucket counts of everything in between
+        std::array<quint64, LatencyBuckets> latencyHist{};
+    };
+    std::map<int, SlaveQueue> slaves;
+    int lastServed = -1;
+    qsizetype queued = 0;
+    QElapsedTimer clock;
     Device config;
     string connectionString;
 public:
     MasterDevice(RtuDevice config, QObject* parent);
     MasterDevice(TcpDevice config, QObject* parent);
     void Start();
+    bool IsConnected() const { return connectedCount > 0; }
 
     enum Op {
         op_read,
@@ -48,10 +104,19 @@ public:
     };
 
     void Execute(Op op, Request req);
+    //! requests `slave_id` may send in a row before the next slave with work, at least 1
+    void SetWeight(int slave_id, unsigned weight);
+    //! response times, errors and backoff state of one slave on this bus
+    QVariantMap SlaveStats(int slave_id) const;
 signals:
     void ConnectedChanged(bool state);
 private:
     MasterDevice(Device const& conf, QObject* parent);
+    Connection* pickConnection();
+    bool pickRequest(Request& out, bool& isRead);
+    void finished(int slave_id, qint64 sentAtUs, QModbusDevice::Error error);
+    void onStateChanged(Connection& conn, QModbusClient::State state);
+    void send(Connection& conn, Request req, bool isRead);
     void nextReq();
     void doConnect();
 };
@@ -59,24 +124,54 @@ private:
 class SlaveDevice : public QObject {
     Q_OBJECT
 
-    bool started = false;
     QPointer<Worker> claimer;
-    QTimer* reconnect = nullptr;
     ::QModbusServer* server = nullptr;
+protected:
+    bool started = false;
+    QTimer* reconnect = nullptr;
     Device config;
     string connectionString;
 public:
     SlaveDevice(RtuDevice config, QObject* parent);
     SlaveDevice(TcpDevice config, QObject* parent);
 
-    //! a server can host exactly one ModbusSlave (single server address + map)
-    ::QModbusServer* Claim(Worker* by);
-    void Start();
+    //! a server can host exactly one ModbusSlave (single server address + map),
+    //! `unit` is only used by the gateway
+    virtual ::QModbusServer* Claim(Worker* by, int unit);
+    virtual void Start();
 signals:
     void ConnectedChanged(bool state);
-private:
+protected:
     SlaveDevice(Device const& conf, QObject* parent);
+private:
+    void doListen();
+};
+
+//! one TCP port for many slaves: requests are routed by MBAP unit id to the ModbusSlave
+//! claiming it, unknown units go to downstream masters (see GatewayConfig::forward)
+class GatewayDevice final : public SlaveDevice {
+    Q_OBJECT
+
+    struct Unit;
+    string host;
+    uint16_t port{};
+    QTcpServer* listener = nullptr;
+    //! by unit id
+    std::array<QPointer<Worker>, 256> claimers{};
+    std::array<Unit*, 256> units{};
+    std::array<MasterDevice*, 256> routes{};
+    MasterDevice* fallback = nullptr;
+public:
+    GatewayDevice(GatewayConfig config, QObject* parent);
+
+    ::QModbusServer* Claim(Worker* by, int unit) override;
+    void Start() override;
+private:
     void doListen();
+    void onClient(QTcpSocket* sock);
+    void handle(QTcpSocket* sock, quint16 tid, quint8 unit, QModbusRequest const& req);
+    void forward(MasterDevice* to, QPointer<QTcpSocket> sock, quint16 tid, quint8 unit, QModbusRequest const& req);
+    static void reply(QTcpSocket* sock, quint16 tid, quint8 unit, QModbusPdu const& resp);
 };
 
 }
@@ -0,0 +1,288 @@
+#include "modbus_device.hpp"
+#include <QModbusServer>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wnull-dereference"
+#endif
+
+using namespace radapter;
+using namespace radapter::modbus;
+
+// never listens by itself: the gateway feeds it requests of its unit id
+struct GatewayDevice::Unit final : QModbusServer {
+    using QModbusServer::QModbusServer;
+    using QModbusServer::processRequest;
+protected:
+    bool open() override {
+        setState(ConnectedState);
+        return true;
+    }
+    void close() override {
+        setState(UnconnectedState);
+    }
+};
+
+// MBAP header: transaction id, protocol id (0), length (unit + pdu), unit id
+static constexpr int MbapSize = 7;
+static constexpr int MaxPduSize = 253;
+
+static quint16 be16(const char* at) {
+    return qFromBigEndian<quint16>(at);
+}
+
+GatewayDevice::GatewayDevice(GatewayConfig conf, QObject *parent) :
+    SlaveDevice(static_cast<Device&>(conf), parent),
+    host(conf.host),
+    port(conf.port),
+    listener(new QTcpServer(this))
+{
+    connectionString = fmt::format("{}:{}", host, port);
+    setObjectName(QString::fromStdString(fmt::format("GatewayDevice({}/{})", connectionString, config.name.value)));
+    if (conf.forward) {
+        for (auto& fwd: *conf.forward) {
+            if (!fwd.device) {
+                Raise("{}: forward: device expected", objectName());
+            }
+            if (!fwd.units) {
+                if (fallback) {
+                    Raise("{}: only one forward may go without 'units'", objectName());
+                }
+                fallback = fwd.device;
+                continue;
+            }
+            for (auto unit: *fwd.units) {
+                if (unit > 255) {
+                    Raise("{}: forward: invalid unit id {}", objectName(), unit);
+                }
+                if (routes[unit]) {
+                    Raise("{}: forward: unit {} routed twice", objectName(), unit);
+                }
+                routes[unit] = fwd.device;
+            }
+        }
+    }
+}
+
+QModbusServer* GatewayDevice::Claim(Worker* by, int unit) {
+    if (unit < 0 || unit > 255) {
+        Raise("{}: invalid unit id {}", objectName(), unit);
+    }
+    if (auto& was = claimers[size_t(unit)]) {
+        Raise("{}: unit {} already claimed by '{}' (created at {})",
+              objectName(), unit, was->objectName(), was->_Origin);
+    }
+    if (routes[size_t(unit)]) {
+        Raise("{}: unit {} is already forwarded", objectName(), unit);
+    }
+    claimers[size_t(unit)] = by;
+    auto& slot = units[size_t(unit)];
+    if (!slot) {
+        slot = new Unit(this);
+    }
+    return slot;
+}
+
+void GatewayDevice::Start() {
+    if (started) return;
+    started = true;
+    reconnect->setInterval(int(config.reconnect_timeout_ms));
+    reconnect->setSingleShot(true);
+    reconnect->callOnTimeout(this, &GatewayDevice::doListen);
+    connect(listener, &QTcpServer::newConnection, this, [this]{
+        while (auto* sock = listener->nextPendingConnection()) {
+            onClient(sock);
+        }
+    });
+    for (auto* down: routes) {
+        if (down) down->Start();
+    }
+    if (fallback) {
+        fallback->Start();
+    }
+    doListen();
+}
+
+void GatewayDevice::doListen() {
+    if (listener->isListening()) {
+        return;
+    }
+    if (!listener->listen(QHostAddress(QString::fromStdString(host)), port)) {
+        static_cast<Instance*>(parent())->Warn("modbus", "{}: could not start: {}",
+                                               objectName(), listener->errorString());
+        reconnect->start();
+        return;
+    }
+    static_cast<Instance*>(parent())->Info("modbus", "{}: listening", objectName());
+    emit ConnectedChanged(true);
+}
+
+void GatewayDevice::onClient(QTcpSocket* sock) {
+    sock->setParent(this);
+    connect(sock, &QTcpSocket::disconnected, sock, &QObject::deleteLater);
+    auto buffer = std::make_shared<QByteArray>();
+    connect(sock, &QTcpSocket::readyRead, this, [this, sock, buffer]{
+        buffer->append(sock->readAll());
+        qsizetype used = 0;
+        while (buffer->size() - used >= MbapSize) {
+            auto* head = buffer->constData() + used;
+            auto tid = be16(head);
+            auto proto = be16(head + 2);
+            auto len = be16(head + 4);
+            if (proto != 0 || len < 2 || len > MaxPduSize + 1) {
+                static_cast<Instance*>(parent())->Warn("modbus", "{}: malformed frame from {}, dropping client",
+                                                       objectName(), sock->peerAddress().toString());
+                sock->abort();
+                return;
+            }
+            if (buffer->size() - used < 6 + len) {
+                break;
+            }
+            auto unit = quint8(head[6]);
+            QModbusRequest req(QModbusPdu::FunctionCode(quint8(head[7])), QByteArray(head + 8, len - 2));
+            used += 6 + len;
+            handle(sock, tid, unit, req);
+        }
+        buffer->remove(0, used);
+    });
+}
+
+void GatewayDevice::handle(QTcpSocket* sock, quint16 tid, quint8 unit, QModbusRequest const& req) {
+    if (auto* local = units[unit]; local && claimers[unit]) {
+        reply(sock, tid, unit, local->processRequest(req));
+    } else if (auto* down = routes[unit] ? routes[unit] : fallback) {
+        forward(down, sock, tid, unit, req);
+    } else {
+        reply(sock, tid, unit, QModbusExceptionResponse(req.functionCode(), QModbusPdu::GatewayPathUnavailable));
+    }
+}
+
+// quantity limits of the spec: the reply byte count is a single byte
+static int maxQuantity(QModbusPdu::FunctionCode fc) {
+    using FC = QModbusPdu::FunctionCode;
+    switch (fc) {
+    case FC::ReadCoils:
+    case FC::ReadDiscreteInputs: return 2000;
+    case FC::ReadHoldingRegisters:
+    case FC::ReadInputRegisters: return 125;
+    case FC::WriteMultipleCoils: return 1968;
+    case FC::WriteMultipleRegisters: return 123;
+    default: return 0; // single writes: arg is the value
+    }
+}
+
+// only the function codes the master queue can express as a QModbusDataUnit are forwarded
+void GatewayDevice::forward(MasterDevice* to, QPointer<QTcpSocket> sock, quint16 tid, quint8 unit, QModbusRequest const& req) {
+    using FC = QModbusPdu::FunctionCode;
+    auto fc = req.functionCode();
+    auto data = req.data();
+    auto fail = [&](QModbusPdu::ExceptionCode code) {
+        reply(sock, tid, unit, QModbusExceptionResponse(fc, code));
+    };
+    if (data.size() < 4) {
+        return fail(QModbusPdu::IllegalDataValue);
+    }
+    auto address = be16(data.constData());
+    auto arg = be16(data.constData() + 2);
+    if (auto limit = maxQuantity(fc); limit && (!arg || arg > limit)) {
+        return fail(QModbusPdu::IllegalDataValue);
+    }
+    auto op = MasterDevice::op_read;
+    QModbusDataUnit target;
+    switch (fc) {
+    case FC::ReadCoils:
+        target = QModbusDataUnit(QModbusDataUnit::Coils, address, arg); break;
+    case FC::ReadDiscreteInputs:
+        target = QModbusDataUnit(QModbusDataUnit::DiscreteInputs, address, arg); break;
+    case FC::ReadHoldingRegisters:
+        target = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, address, arg); break;
+    case FC::ReadInputRegisters:
+        target = QModbusDataUnit(QModbusDataUnit::InputRegisters, address, arg); break;
+    case FC::WriteSingleCoil:
+        if (arg != 0xFF00 && arg != 0x0000) {
+            return fail(QModbusPdu::IllegalDataValue);
+        }
+        op = MasterDevice::op_write;
+        target = QModbusDataUnit(QModbusDataUnit::Coils, address, QList<quint16>{quint16(arg == 0xFF00)}); break;
+    case FC::WriteSingleRegister:
+        op = MasterDevice::op_write;
+        target = QModbusDataUnit(QModbusDataUnit::HoldingRegisters, address, QList<quint16>{arg}); break;
+    case FC::WriteMultipleCoils:
+    case FC::WriteMultipleRegisters: {
+        op = MasterDevice::op_write;
+        bool coils = fc == FC::WriteMultipleCoils;
+        auto bytes = data.size() > 4 ? quint8(data[4]) : 0;
+        if (!arg || data.size() != 5 + bytes || bytes != (coils ? (arg + 7) / 8 : arg * 2)) {
+            return fail(QModbusPdu::IllegalDataValue);
+        }
+        QList<quint16> values(arg);
+        for (int i = 0; i < arg; ++i) {
+            values[i] = coils
+                            ? quint16((quint8(data[5 + i / 8]) >> (i % 8)) & 1)
+                            : be16(data.constData() + 5 + i * 2);
+        }
+        target = QModbusDataUnit(coils ? QModbusDataUnit::Coils : QModbusDataUnit::HoldingRegisters, address, values);
+        break;
+    }
+    default:
+        return fail(QModbusPdu::IllegalFunction);
+    }
+    Request fwd;
+    fwd.ctx = this;
+    fwd.slave_id = unit;
+    fwd.unit = target;
+    fwd.cb = [sock, tid, unit, fc, data](QModbusDataUnit result, std::exception_ptr except) {
+        if (!sock) return;
+        if (except) {
+            reply(sock, tid, unit, QModbusExceptionResponse(fc, QModbusPdu::GatewayTargetDeviceFailedToRespond));
+            return;
+        }
+        QByteArray out;
+        switch (fc) {
+        case FC::ReadCoils:
+        case FC::ReadDiscreteInputs: {
+            auto count = int(result.valueCount());
+            out.fill(0, 1 + (count + 7) / 8);
+            out[0] = char((count + 7) / 8);
+            for (int i = 0; i < count; ++i) {
+                if (result.value(i)) {
+                    out[1 + i / 8] = char(quint8(out[1 + i / 8]) | (1 << (i % 8)));
+                }
+            }
+            break;
+        }
+        case FC::ReadHoldingRegisters:
+        case FC::ReadInputRegisters: {
+            auto count = int(result.valueCount());
+            out.resize(1 + count * 2);
+            out[0] = char(count * 2);
+            for (int i = 0; i < count; ++i) {
+                qToBigEndian<quint16>(result.value(i), out.data() + 1 + i * 2);
+            }
+            break;
+        }
+        case FC::WriteSingleCoil:
+        case FC::WriteSingleRegister:
+            out = data;
+            break;
+        default: // multiple writes: address + count
+            out = data.left(4);
+            break;
+        }
+        reply(sock, tid, unit, QModbusResponse(fc, out));
+    };
+    to->Execute(op, std::move(fwd));
+}
+
+void GatewayDevice::reply(QTcpSocket* sock, quint16 tid, quint8 unit, QModbusPdu const& resp) {
+    auto pdu = resp.data();
+    QByteArray frame(MbapSize + 1 + pdu.size(), Qt::Uninitialized);
+    qToBigEndian<quint16>(tid, frame.data());
+    qToBigEndian<quint16>(0, frame.data() + 2);
+    qToBigEndian<quint16>(quint16(2 + pdu.size()), frame.data() + 4);
+    frame[6] = char(unit);
+    frame[7] = char(quint8(resp.functionCode()) | (resp.isException() ? 0x80 : 0));
+    std::copy(pdu.cbegin(), pdu.cend(), frame.begin() + MbapSize + 1);
+    sock->write(frame);
+}
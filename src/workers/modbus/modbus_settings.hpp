@@ -41,6 +41,9 @@ enum RegisterValueType : uint8_t {
     uint16,
     uint32,
     float32,
+    int16,
+    int32,
+    float64,
 
     bit,
     Default = uint16,
@@ -49,6 +52,18 @@ DESCRIBE("modbus::RegisterValueType", RegisterValueType, void) {
     MEMBER("uint16", uint16);
     MEMBER("uint32", uint32);
     MEMBER("float32", float32);
+    MEMBER("int16", int16);
+    MEMBER("int32", int32);
+    MEMBER("float64", float64);
+}
+
+enum ArrayFormat : uint8_t {
+    array_list,
+    array_bytes,
+};
+DESCRIBE("modbus::ArrayFormat", ArrayFormat, void) {
+    MEMBER("list", array_list);
+    MEMBER("bytes", array_bytes);
 }
 
 struct RegisterPacking {
@@ -66,6 +81,9 @@ struct Register {
     WithDefault<RegisterValueType> type = defaultValueType;
     WithDefault<RegisterMode> mode = defaultMode;
     OptionalPtr<LuaFunction> validator;
+    optional<string> group; // poll group, "default" if not set
+    WithDefault<unsigned> count = 0u; // > 0: block of `count` values of `type`
+    WithDefault<ArrayFormat> format = array_list; // how blocks are delivered
 };
 DESCRIBE("modbus::Register", Register, void) {
     MEMBER("index", &_::index);
@@ -73,6 +91,9 @@ DESCRIBE("modbus::Register", Register, void) {
     MEMBER("type", &_::type);
     MEMBER("mode", &_::mode);
     MEMBER("validator", &_::validator);
+    MEMBER("group", &_::group);
+    MEMBER("count", &_::count);
+    MEMBER("format", &_::format);
 }
 
 using SingleTypeMap = map<string, Register>;
@@ -107,6 +128,9 @@ struct Device {
     WithDefault<unsigned> reconnect_timeout_ms = 1000u;
     WithDefault<OverflowBehaviour> on_read_overflow = pop_first;
     WithDefault<OverflowBehaviour> on_write_overflow = pop_first;
+    // a slave that times out is skipped for slave_backoff_ms, doubled on each timeout in a row
+    WithDefault<unsigned> slave_backoff_ms = 1000u;
+    WithDefault<unsigned> max_slave_backoff_ms = 30000u;
 };
 DESCRIBE("modbus::Device", Device, void) {
     MEMBER("name", &_::name);
@@ -116,6 +140,8 @@ DESCRIBE("modbus::Device", Device, void) {
     MEMBER("reconnect_timeout_ms", &_::reconnect_timeout_ms);
     MEMBER("on_read_overflow", &_::on_read_overflow);
     MEMBER("on_write_overflow", &_::on_write_overflow);
+    MEMBER("slave_backoff_ms", &_::slave_backoff_ms);
+    MEMBER("max_slave_backoff_ms", &_::max_slave_backoff_ms);
 }
 
 struct RtuDevice : Device {
@@ -141,11 +167,16 @@ DESCRIBE("modbus::RtuDevice", RtuDevice, void) {
 struct TcpDevice : Device {
     string host;
     uint16_t port;
+    // master only: outstanding transactions per connection and parallel connections to the host
+    WithDefault<unsigned> max_in_flight = 1u;
+    WithDefault<unsigned> connections = 1u;
 };
 DESCRIBE("modbus::TcpDevice", TcpDevice, void) {
     PARENT(Device);
     MEMBER("host", &_::host);
     MEMBER("port", &_::port);
+    MEMBER("max_in_flight", &_::max_in_flight);
+    MEMBER("connections", &_::connections);
 }
 
 struct WorkerConfig : ::radapter::WorkerConfig {
@@ -190,7 +221,13 @@ struct MasterConfig : WorkerConfig {
     WithDefault<unsigned> response_time = 150u;
     WithDefault<unsigned> poll_rate = 500u;
     WithDefault<unsigned> write_retries = 3u;
+    WithDefault<unsigned> max_gap = 0u;
+    WithDefault<unsigned> max_regs_per_request = 125u;
+    WithDefault<unsigned> max_bits_per_request = 2000u;
+    optional<map<string, unsigned>> poll_groups = {}; // name -> poll rate (ms)
+    WithDefault<bool> poll_on_demand = false; // read only registers someone listens to
     optional<vector<ManualQuery>> queries = {};
+    WithDefault<unsigned> weight = 1u; // requests in a row of this slave on a shared device
 };
 DESCRIBE("modbus::MasterConfig", MasterConfig, void) {
     PARENT(WorkerConfig);
@@ -198,7 +235,30 @@ DESCRIBE("modbus::MasterConfig", MasterConfig, void) {
     MEMBER("response_time", &_::response_time);
     MEMBER("poll_rate", &_::poll_rate);
     MEMBER("write_retries", &_::write_retries);
+    MEMBER("max_gap", &_::max_gap);
+    MEMBER("max_regs_per_request", &_::max_regs_per_request);
+    MEMBER("max_bits_per_request", &_::max_bits_per_request);
+    MEMBER("poll_groups", &_::poll_groups);
+    MEMBER("poll_on_demand", &_::poll_on_demand);
     MEMBER("queries", &_::queries);
+    MEMBER("weight", &_::weight);
+}
+
+struct GatewayForward {
+    MasterDevice* device;
+    optional<vector<unsigned>> units = {}; // every unit without a local slave if not set
+};
+DESCRIBE("modbus::GatewayForward", GatewayForward, void) {
+    MEMBER("device", &_::device);
+    MEMBER("units", &_::units);
+}
+
+struct GatewayConfig : TcpDevice {
+    optional<vector<GatewayForward>> forward = {};
+};
+DESCRIBE("modbus::GatewayConfig", GatewayConfig, void) {
+    PARENT(TcpDevice);
+    MEMBER("forward", &_::forward);
 }
 
 }
@@ -1,5 +1,6 @@
 #include "modbus_device.hpp"
 #include <QModbusServer>
+#include <QTimer>
 
 #ifdef __GNUC__
 #pragma GCC diagnostic ignored "-Wnull-dereference"
@@ -10,10 +11,13 @@ namespace radapter::modbus
 
 struct SlaveConfig : WorkerConfig {
     SlaveDevice* device;
+    // client writes arriving within this window are reported as one message
+    WithDefault<unsigned> write_batch_ms = 0u;
 };
 DESCRIBE("modbus::SlaveConfig", SlaveConfig, void) {
     PARENT(WorkerConfig);
     MEMBER("device", &_::device);
+    MEMBER("write_batch_ms", &_::write_batch_ms);
 }
 
 class Slave : public Worker
@@ -26,6 +30,10 @@ public:
     vector<PreparedRegister> sortedHolding, sortedCoils, sortedDI, sortedInput;
     QMap<string, QVariant> currentState;
     bool applying = false;
+    using Range = std::pair<int, int>; // [first, last) address
+    //! address ranges written by clients since the last flush, by register type
+    std::map<QModbusDataUnit::RegisterType, vector<Range>> dirty;
+    QTimer* batch = nullptr;
 
     Slave(SlaveConfig conf, Instance* parent) :
         Worker(parent,
@@ -35,7 +43,7 @@ public:
                "modbus")
     {
         config = std::move(conf);
-        server = config.device->Claim(this);
+        server = config.device->Claim(this, config.slave_id);
         validateRegisters(config.registers);
         all = prepareWrites(config.registers, true);
         sortedHolding = prepareReadableSorted(config.registers.holding, true);
@@ -57,6 +65,10 @@ public:
         addRange(sortedInput, QModbusDataUnit::InputRegisters);
         server->setMap(map);
 
+        batch = new QTimer(this);
+        batch->setSingleShot(true);
+        batch->setInterval(int(config.write_batch_ms));
+        batch->callOnTimeout(this, &Slave::flushWritten);
         connect(server, &QModbusServer::dataWritten, this, &Slave::onDataWritten);
         config.device->Start();
 
@@ -73,35 +85,41 @@ public:
         }
     }
 
+    vector<PreparedRegister>* sortedFor(QModbusDataUnit::RegisterType type) {
+        switch (type) {
+        case QModbusDataUnit::HoldingRegisters: return &sortedHolding;
+        case QModbusDataUnit::Coils: return &sortedCoils;
+        case QModbusDataUnit::DiscreteInputs: return &sortedDI;
+        case QModbusDataUnit::InputRegisters: return &sortedInput;
+        default: return nullptr;
+        }
+    }
+
     void onDataWritten(QModbusDataUnit::RegisterType type, int address, int size) {
-        if (applying) return;
-        auto* sorted = [&]() -> vector<PreparedRegister>* {
-            switch (type) {
-            case QModbusDataUnit::HoldingRegisters: return &sortedHolding;
-            case QModbusDataUnit::Coils: return &sortedCoils;
-            case QModbusDataUnit::DiscreteInputs: return &sortedDI;
-            case QModbusDataUnit::InputRegisters: return &sortedInput;
-            default: return nullptr;
-            }
-        }();
-        if (!sorted) return;
+        if (applying || size <= 0) return;
+        dirty[type].push_back({address, address + size});
+        if (!batch->isActive()) {
+            batch->start();
+        }
+    }
+
+    //! report everything written since the last flush as one message,
+    //! each merged range is read back from the server at once
+    void flushWritten() {
         FlatMap diff;
-        uint16_t data[2];
-        for (auto& reg: *sorted) {
-            if (reg.index + reg.sizeOf / 2 <= address) continue;
-            if (reg.index >= address + size) break;
-            data[0] = data[1] = 0;
-            server->data(type, uint16_t(reg.index), &data[0]);
-            if (reg.sizeOf == 4) {
-                server->data(type, uint16_t(reg.index + 1), &data[1]);
-            }
-            auto asVariant = decodeRegister(reg, data);
-            auto& current = currentState[reg.key];
-            if (current != asVariant) {
-                current = std::move(asVariant);
-                diff.push_back({reg.key, current});
+        for (auto& [type, ranges]: dirty) {
+            auto* sorted = sortedFor(type);
+            if (!sorted || sorted->empty()) continue;
+            std::sort(ranges.begin(), ranges.end());
+            for (size_t i = 0; i < ranges.size();) {
+                auto [lo, hi] = ranges[i];
+                for (++i; i < ranges.size() && ranges[i].first <= hi; ++i) {
+                    hi = std::max(hi, ranges[i].second);
+                }
+                collectChanged(*sorted, type, lo, hi, diff);
             }
         }
+        dirty.clear();
         if (!diff.empty()) {
             QVariant unflat;
             Unflatten(unflat, diff);
@@ -109,31 +127,92 @@ public:
         }
     }
 
+    void collectChanged(vector<PreparedRegister> const& sorted, QModbusDataUnit::RegisterType type,
+                        int lo, int hi, FlatMap& diff)
+    {
+        // registers do not overlap, so their ends are sorted too
+        auto first = std::partition_point(sorted.begin(), sorted.end(), [&](PreparedRegister const& r){
+            return r.index + r.sizeOf / 2 <= lo;
+        });
+        auto last = std::partition_point(first, sorted.end(), [&](PreparedRegister const& r){
+            return r.index < hi;
+        });
+        if (first == last) return;
+        auto from = std::min(lo, first->index);
+        auto to = std::max(hi, std::prev(last)->index + std::prev(last)->sizeOf / 2);
+        QModbusDataUnit unit(type, from, quint16(to - from));
+        if (!server->data(&unit)) {
+            Warn("could not read back written range {}-{}", from, to);
+            return;
+        }
+        auto values = unit.values();
+        for (auto it = first; it != last; ++it) {
+            auto asVariant = decodeRegister(*it, values.constData() + (it->index - from));
+            auto& current = currentState[it->key];
+            if (current != asVariant) {
+                current = std::move(asVariant);
+                diff.push_back({it->key, current});
+            }
+        }
+    }
+
+    QVariant readRegister(PreparedRegister const& reg, QModbusDataUnit::RegisterType type) {
+        QModbusDataUnit unit(type, reg.index, quint16(reg.sizeOf / 2));
+        if (!server->data(&unit)) {
+            unit.setValues(QList<quint16>(reg.sizeOf / 2, 0));
+        }
+        return decodeRegister(reg, unit.values().constData());
+    }
+
     void OnMsg(QVariant const& msg) override {
         FlatMap flat;
         Flatten(flat, msg);
+        using Address = std::pair<QModbusDataUnit::RegisterType, int>;
+        std::map<Address, uint16_t> words; // whole message, later values win
+        struct Applied {
+            PreparedWriteRegister const* reg;
+            QVariant v; // invalid for single block elements: read back after applying
+        };
+        vector<Applied> applied;
         for (auto& [k, v]: flat) {
             if (!v.isValid()) continue;
-            auto it = all.find(k);
-            if (it == all.end()) continue;
-            auto& reg = it->second;
-            QVector<uint16_t> words;
-            if (!encodeRegister(reg, v, words)) {
+            int element;
+            auto* found = findWritable(all, k, element);
+            if (!found) continue;
+            auto& reg = *found;
+            QVector<uint16_t> encoded;
+            bool ok = element < 0
+                          ? encodeRegister(reg, v, encoded)
+                          : encodeValue(reg.type, reg.packing, v, encoded);
+            if (!ok) {
                 Warn("could not encode '{}' <= {}", k, v.toString());
                 continue;
             }
-            QModbusDataUnit unit;
-            unit.setRegisterType(reg.mbType);
-            unit.setStartAddress(reg.index);
-            unit.setValues(words);
-            applying = true;
-            auto ok = server->setData(unit);
-            applying = false;
-            if (!ok) {
-                Warn("could not set '{}': {}", k, server->errorString());
-            } else {
-                currentState[k] = v;
+            auto start = element < 0 ? reg.index : reg.index + element * getSizeOf(reg.type) / 2;
+            for (int i = 0; i < encoded.size(); ++i) {
+                words[{reg.mbType, start + i}] = encoded[i];
             }
+            applied.push_back({&reg, element < 0 ? v : QVariant{}});
+        }
+        if (words.empty()) return;
+        // one setData() per contiguous range
+        bool failed = false;
+        applying = true;
+        for (auto it = words.begin(); it != words.end();) {
+            auto [type, from] = it->first;
+            QList<quint16> values;
+            auto next = from;
+            for (; it != words.end() && it->first == Address{type, next}; ++it, ++next) {
+                values.append(it->second);
+            }
+            if (!server->setData(QModbusDataUnit(type, from, values))) {
+                Warn("could not set {} registers at {}: {}", values.size(), from, server->errorString());
+                failed = true;
+            }
+        }
+        applying = false;
+        for (auto& [reg, v]: applied) {
+            currentState[reg->key] = failed || !v.isValid() ? readRegister(*reg, reg->mbType) : v;
         }
     }
 };
@@ -1,7 +1,10 @@
 #pragma once
 #include "modbus_settings.hpp"
 #include "qmodbusdataunit.h"
+#include "utils.hpp"
 #include <QtEndian>
+#include <QVarLengthArray>
+#include <algorithm>
 
 namespace radapter::modbus
 {
@@ -12,7 +15,9 @@ struct PreparedRegister {
     RegisterPacking packing{};
     optional<LuaFunction> validator;
     int index{};
-    int sizeOf{};
+    int sizeOf{}; // whole register (all elements of a block)
+    unsigned count{}; // block elements, 0 for single values
+    bool asBytes{};
 };
 
 struct PreparedWriteRegister : PreparedRegister {
@@ -20,13 +25,57 @@ struct PreparedWriteRegister : PreparedRegister {
     QModbusDataUnit::RegisterType mbType{};
 };
 
+//! precompiled decoding of one register out of a reply
+struct DecodeStep {
+    uint32_t slot;     // index into the owner's state table
+    uint16_t offset;   // word offset from the reply start address
+    uint16_t words;    // whole register
+    uint16_t count;    // block elements, 0 for single values
+    uint8_t elemWords; // words per value
+    RegisterValueType type;
+    bool asBytes;
+    bool byteSwap;     // swap bytes of every word
+    bool wordSwap;     // reverse the words of every value
+};
+
 struct MergedRead {
     vector<PreparedRegister> regs;
     QModbusDataUnit unit;
+    vector<DecodeStep> plan; // same order as regs, see compileDecodePlan()
+    QList<quint16> lastReply; // an unchanged reply is skipped with a single compare
+    //! > 0: a single register larger than one PDU, read in requests of this many values
+    //! and reassembled before decoding
+    unsigned chunk = 0;
 };
 
 using PreparedReads = vector<MergedRead>;
 
+inline unsigned requestsOf(MergedRead const& read) {
+    auto total = unsigned(read.unit.valueCount());
+    return read.chunk ? (total + read.chunk - 1) / read.chunk : 1u;
+}
+
+inline unsigned requestsOf(PreparedReads const& reads) {
+    unsigned total = 0;
+    for (auto& read: reads) {
+        total += requestsOf(read);
+    }
+    return total;
+}
+
+// Modbus PDU limits: FC03/FC04 read at most 125 registers, FC01/FC02 at most 2000 bits
+constexpr unsigned MaxReadRegs = 125;
+constexpr unsigned MaxReadBits = 2000;
+// FC16 writes at most 123 registers, FC15 at most 1968 coils
+constexpr unsigned MaxWriteRegs = 123;
+constexpr unsigned MaxWriteBits = 1968;
+
+struct ReadPlan {
+    unsigned max_gap = 0; // unused addresses allowed to be read to join two requests
+    unsigned max_regs_per_request = MaxReadRegs;
+    unsigned max_bits_per_request = MaxReadBits;
+};
+
 using RegPair = std::pair<string, Register>;
 
 static int getSizeOf(RegisterValueType type) {
@@ -34,12 +83,28 @@ static int getSizeOf(RegisterValueType type) {
     case defaultValueType:
     case bit: return 2; //still a 'word'
     case uint16: return 2;
+    case int16: return 2;
     case float32: return 4;
     case uint32: return 4;
+    case int32: return 4;
+    case float64: return 8;
     }
     Q_UNREACHABLE();
 }
 
+static void prepareRegister(PreparedRegister& out, string const& key, Register const& reg) {
+    out.index = reg.index;
+    out.key = key;
+    out.type = reg.type;
+    if (reg.validator) {
+        out.validator = *reg.validator.value;
+    }
+    out.packing = reg.packing;
+    out.count = reg.count;
+    out.asBytes = reg.count && reg.format == array_bytes;
+    out.sizeOf = getSizeOf(reg.type) * int(reg.count ? reg.count.value : 1u);
+}
+
 template<typename T>
 static bool compareByIndex(T const& lhs, T const& rhs) noexcept {
     return lhs.index < rhs.index;
@@ -90,77 +155,128 @@ static void validateRegisters(RegistersMap& regs) {
     }
 }
 
+// O(n log n): sort once, then collisions/overlaps can only be between neighbours
+template<typename T>
+static void sortByIndex(vector<T>& regs) {
+    std::sort(regs.begin(), regs.end(), compareByIndex<T>);
+    for (size_t i = 1; i < regs.size(); ++i) {
+        auto& prev = regs[i - 1];
+        auto& cur = regs[i];
+        if (prev.index == cur.index) {
+            Raise("Index collision for registers '{}' and '{}' @ index {}",
+                      prev.key, cur.key, cur.index);
+        } else if (prev.index + prev.sizeOf/2 > cur.index) {
+            Raise("Register overlap of '{}' and '{}' @ index {} (+ {} > {})",
+                      prev.key, cur.key, prev.index, prev.sizeOf / 2, cur.index);
+        }
+    }
+}
+
 static vector<PreparedRegister> prepareReadableSorted(SingleTypeMap const& map, bool include_write_only = false) {
     vector<PreparedRegister> sorted;
+    sorted.reserve(map.size());
     for (auto& [k, reg]: map) {
         if (reg.mode == write && !include_write_only) {
             continue; //write-only register
         }
         PreparedRegister meta;
-        meta.index = reg.index;
-        meta.key = k;
-        meta.type = reg.type;
-        if (reg.validator) {
-            meta.validator = *reg.validator.value;
-        }
-        meta.sizeOf = getSizeOf(reg.type);
-        meta.packing = reg.packing;
-        auto it = std::lower_bound(sorted.begin(), sorted.end(), meta, compareByIndex<PreparedRegister>);
-        if (it == sorted.end()) {
-            sorted.push_back(std::move(meta));
-        } else if (it->index == meta.index) {
-            Raise("Index collision for registers '{}' and '{}' @ index {}",
-                      it->key, k, it->index);
-        } else if (meta.index + meta.sizeOf/2 > it->index) {
-            Raise("Register overlap of '{}' and '{}' @ index {} (+ {} > {})",
-                      k, it->key, meta.index, meta.sizeOf / 2, it->index);
-        } else {
-            sorted.insert(it, std::move(meta));
-        }
+        prepareRegister(meta, k, reg);
+        sorted.push_back(std::move(meta));
     }
+    sortByIndex(sorted);
     return sorted;
 }
 
+static bool isBitType(QModbusDataUnit::RegisterType type) noexcept {
+    return type == QModbusDataUnit::Coils || type == QModbusDataUnit::DiscreteInputs;
+}
+
+//! Greedy packing of sorted registers into requests. A request grows until the next
+//! register would leave a hole larger than max_gap or make the request longer than
+//! the PDU limit. Any sub-range of a valid request is valid too, so taking as much
+//! as possible each time yields the minimal number of requests.
+//! A register longer than the limit is read alone, in several requests (see MergedRead::chunk).
 static void mergeSingle(
     vector<MergedRead> & out,
     SingleTypeMap const& map,
-    QModbusDataUnit::RegisterType type)
+    QModbusDataUnit::RegisterType type,
+    ReadPlan const& plan)
 {
     auto sorted = prepareReadableSorted(map);
+    int maxCount = int(isBitType(type) ? plan.max_bits_per_request : plan.max_regs_per_request);
+    int maxGap = int(plan.max_gap);
     MergedRead merge;
+    int start = 0;
+    int end = 0; // one past the last covered address of `merge`
+    auto flush = [&]{
+        merge.unit.setRegisterType(type);
+        merge.unit.setStartAddress(start);
+        merge.unit.setValueCount(uint16_t(end - start));
+        out.push_back(std::move(merge));
+        merge = {};
+    };
     for (auto& reg: sorted) {
-        auto setAsFirst = [&](auto& reg){
+        auto count = reg.sizeOf/2;
+        if (count > maxCount) {
+            // a block on its own, split into PDU-sized reads
+            if (!merge.regs.empty()) {
+                flush();
+            }
+            start = reg.index;
+            end = reg.index + count;
+            merge.chunk = unsigned(maxCount);
             merge.regs.push_back(std::move(reg));
-            merge.unit.setRegisterType(type);
-            merge.unit.setStartAddress(reg.index);
-            merge.unit.setValueCount(uint16_t(reg.sizeOf/2));
-        };
-        if (merge.regs.empty()) {
-            setAsFirst(reg);
+            flush();
             continue;
         }
-        auto lastIdx = merge.regs.back().index;
-        auto lastCount = merge.regs.back().sizeOf/2;
-        if (reg.index == lastIdx + lastCount) {
-            merge.regs.push_back(std::move(reg));
-            merge.unit.setValueCount(merge.unit.valueCount() + uint16_t(reg.sizeOf/2));
-        } else {
-            out.push_back(std::move(merge));
-            setAsFirst(reg);
+        if (!merge.regs.empty()
+            && (reg.index - end > maxGap || reg.index + count - start > maxCount))
+        {
+            flush();
+        }
+        if (merge.regs.empty()) {
+            start = reg.index;
         }
+        end = reg.index + count;
+        merge.regs.push_back(std::move(reg));
     }
     if (!merge.regs.empty()) {
-        out.push_back(std::move(merge));
+        flush();
     }
 }
 
 [[maybe_unused]]
-static PreparedReads prepareReads(RegistersMap const& map) {
+static PreparedReads prepareReads(RegistersMap const& map, ReadPlan const& plan = {}) {
     PreparedReads result;
-    mergeSingle(result, map.holding.value, QModbusDataUnit::HoldingRegisters);
-    mergeSingle(result, map.di.value, QModbusDataUnit::DiscreteInputs);
-    mergeSingle(result, map.input.value, QModbusDataUnit::InputRegisters);
-    mergeSingle(result, map.coils.value, QModbusDataUnit::Coils);
+    mergeSingle(result, map.holding.value, QModbusDataUnit::HoldingRegisters, plan);
+    mergeSingle(result, map.di.value, QModbusDataUnit::DiscreteInputs, plan);
+    mergeSingle(result, map.input.value, QModbusDataUnit::InputRegisters, plan);
+    mergeSingle(result, map.coils.value, QModbusDataUnit::Coils, plan);
+    return result;
+}
+
+constexpr auto DefaultPollGroup = "default";
+
+static string const& groupOf(Register const& reg) {
+    static const string def = DefaultPollGroup;
+    return reg.group ? *reg.group : def;
+}
+
+//! registers of `map` that are polled by `group`
+[[maybe_unused]]
+static RegistersMap filterGroup(RegistersMap const& map, string const& group) {
+    RegistersMap result;
+    auto filter = [&](SingleTypeMap const& src, SingleTypeMap& dst) {
+        for (auto& [k, reg]: src) {
+            if (groupOf(reg) == group) {
+                dst.emplace(k, reg);
+            }
+        }
+    };
+    filter(map.holding.value, result.holding.value);
+    filter(map.coils.value, result.coils.value);
+    filter(map.di.value, result.di.value);
+    filter(map.input.value, result.input.value);
     return result;
 }
 
@@ -225,28 +341,17 @@ static PreparedWrites prepareWrites(RegistersMap const& map, bool include_read_o
                 continue;
             }
             PreparedWriteRegister reg;
-            reg.index = r.index;
+            prepareRegister(reg, k, r);
             reg.writeOnly = r.mode == RegisterMode::write;
             reg.mbType = t;
-            reg.key = k;
-            if (r.validator) {
-                reg.validator = *r.validator.value;
-            }
-            reg.packing = r.packing;
-            reg.type = r.type;
-            reg.sizeOf = getSizeOf(reg.type);
-            auto it = std::lower_bound(regs.begin(), regs.end(),
-                                       reg, compareByIndex<PreparedWriteRegister>);
-            if (it == regs.end()) {
-                regs.push_back(std::move(reg));
-            } else if (reg.index + reg.sizeOf/2 > it->index) {
-                Raise("Register overlap of '{}' and '{}' @ index {} (+ {} > {})",
-                          reg.key, it->key, reg.index,
-                          reg.sizeOf/2, it->index);
-            } else {
-                regs.insert(it, std::move(reg));
+            auto limit = int(t == QModbusDataUnit::Coils ? MaxWriteBits : MaxWriteRegs);
+            if (!include_read_only && reg.sizeOf/2 > limit) {
+                Raise("Register '{}' ({} words) does not fit into a single write (max {})",
+                          k, reg.sizeOf/2, limit);
             }
+            regs.push_back(std::move(reg));
         }
+        sortByIndex(regs);
         for (auto& r: regs) {
             result[r.key] = std::move(r);
         }
@@ -258,51 +363,200 @@ static PreparedWrites prepareWrites(RegistersMap const& map, bool include_read_o
     return result;
 }
 
+struct Unpacking {
+    bool byteSwap;
+    bool wordSwap;
+};
+
+static Unpacking unpackingFor(PreparedRegister const& reg) {
+    constexpr auto self = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? little : big;
+    Unpacking res;
+    res.byteSwap = reg.type != bit && reg.packing.byte != self;
+    // reading a foreign-endian multi-word value also reverses its words, on top of the word order itself
+    res.wordSwap = getSizeOf(reg.type) > 2 && ((reg.packing.word != self) != res.byteSwap);
+    return res;
+}
+
+//! raw register words -> native layout of `elemWords`-sized values, in place.
+//! Plain loops over the whole block, so the compiler can vectorize them
+static void unpackWords(uint16_t* words, int total, int elemWords, Unpacking how) {
+    if (how.byteSwap) {
+        for (int i = 0; i < total; ++i) {
+            words[i] = qbswap(words[i]);
+        }
+    }
+    if (how.wordSwap && elemWords > 1) {
+        for (int i = 0; i + elemWords <= total; i += elemWords) {
+            std::reverse(words + i, words + i + elemWords);
+        }
+    }
+}
+
+//! `slotOf(reg)` assigns a state slot to every register of `read`
+template<typename SlotOf>
+static void compileDecodePlan(MergedRead& read, SlotOf&& slotOf) {
+    read.plan.clear();
+    read.plan.reserve(read.regs.size());
+    for (auto& reg: read.regs) {
+        auto how = unpackingFor(reg);
+        DecodeStep step;
+        step.slot = uint32_t(slotOf(reg));
+        step.offset = uint16_t(reg.index - read.unit.startAddress());
+        step.words = uint16_t(reg.sizeOf / 2);
+        step.count = uint16_t(reg.count);
+        step.elemWords = uint8_t(getSizeOf(reg.type) / 2);
+        step.type = reg.type;
+        step.asBytes = reg.asBytes;
+        step.byteSwap = how.byteSwap;
+        step.wordSwap = how.wordSwap;
+        read.plan.push_back(step);
+    }
+}
+
+//! `words` hold one value in native layout
+static QVariant decodeValue(RegisterValueType type, const uint16_t* words) {
+    switch (type) {
+    case defaultValueType: assert(false && "lib error"); std::abort();
+    case bit: return words[0] ? QVariant(true) : QVariant(false);
+    case uint16: return words[0];
+    case int16: return int(int16_t(words[0]));
+    case uint32: {
+        uint32_t v;
+        memcpy(&v, words, sizeof(v));
+        return v;
+    }
+    case int32: {
+        int32_t v;
+        memcpy(&v, words, sizeof(v));
+        return v;
+    }
+    case float32: {
+        float v;
+        memcpy(&v, words, sizeof(v));
+        return v;
+    }
+    case float64: {
+        double v;
+        memcpy(&v, words, sizeof(v));
+        return v;
+    }
+    }
+    return {};
+}
+
+//! `words` hold the whole register in native layout (see unpackWords())
 [[maybe_unused]]
-static void applyPacking(QVector<uint16_t>& words, RegisterPacking pack) {
-    auto self = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? little : big;
-    if (words.size() == 2 && self != pack.word) {
-        std::swap(words[0], words[1]);
+static QVariant decodeWords(RegisterValueType type, unsigned count, bool asBytes, const uint16_t* words) {
+    if (!count) {
+        return decodeValue(type, words);
     }
-    for (auto& word: words) {
-        if (pack.byte == little) {
-            word = qToLittleEndian(word);
-        } else {
-            word = qToBigEndian(word);
+    auto elem = getSizeOf(type) / 2;
+    if (asBytes) {
+        if (type == bit) {
+            QByteArray res(qsizetype(count), Qt::Uninitialized);
+            for (unsigned i = 0; i < count; ++i) {
+                res[i] = words[i] ? 1 : 0;
+            }
+            return res;
         }
+        return QByteArray(reinterpret_cast<const char*>(words), qsizetype(count) * elem * 2);
     }
+    QVariantList res;
+    res.reserve(count);
+    for (unsigned i = 0; i < count; ++i) {
+        res.push_back(decodeValue(type, words + i * elem));
+    }
+    return res;
 }
 
-template<typename T>
-static T parseWords(RegisterPacking packing, const void* val) {
-    if (packing.byte == big) {
-        return qFromBigEndian<T>(val);
-    } else {
-        return qFromLittleEndian<T>(val);
+//! `raw` holds sizeOf/2 register words as read from the device
+[[maybe_unused]]
+static QVariant decodeRegister(PreparedRegister const& reg, const uint16_t* raw) {
+    QVarLengthArray<uint16_t, 4> words(raw, raw + reg.sizeOf / 2);
+    unpackWords(words.data(), int(words.size()), getSizeOf(reg.type) / 2, unpackingFor(reg));
+    return decodeWords(reg.type, reg.count, reg.asBytes, words.data());
+}
+
+//! key split into parts once, same rules as Unflatten()
+struct KeyPart {
+    QString key;
+    int index = -1; // "[N]" parts address lists
+};
+using KeyPath = vector<KeyPart>;
+
+[[maybe_unused]]
+static KeyPath compileKeyPath(string_view key) {
+    KeyPath path;
+    if (key.size() && key[0] == ':') {
+        key = key.substr(1);
     }
+    while (true) {
+        auto split = key.find(':');
+        auto part = key.substr(0, split);
+        auto idx = tryInt(part);
+        if (idx < 0 || idx > (std::numeric_limits<int>::max)()) {
+            path.push_back({QString::fromUtf8(part.data(), int(part.size()))});
+        } else {
+            path.push_back({{}, int(idx)});
+        }
+        if (split == string_view::npos) break;
+        key = key.substr(split + 1);
+    }
+    return path;
 }
 
-//! data must contain register words in poll order; word packing is applied here
 [[maybe_unused]]
-static QVariant decodeRegister(PreparedRegister const& reg, uint16_t (&data)[2]) {
-    constexpr auto self = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? little : big;
-    if (reg.packing.word != self) {
-        std::swap(data[0], data[1]);
+static void insertPath(QVariant& out, KeyPath const& path, QVariant const& value) {
+    QVariant* level = &out;
+    for (auto& part: path) {
+        if (part.index < 0) {
+            if (level->metaType().id() != QMetaType::QVariantMap) {
+                *level = QVariantMap{};
+            }
+            level = &(*static_cast<QVariantMap*>(level->data()))[part.key];
+        } else {
+            if (level->metaType().id() != QMetaType::QVariantList) {
+                *level = QVariantList{};
+            }
+            auto& list = *static_cast<QVariantList*>(level->data());
+            while (list.size() <= part.index) {
+                list.push_back(QVariant{});
+            }
+            level = &list[part.index];
+        }
     }
-    switch (reg.type) {
-    case defaultValueType: assert(false && "lib error"); std::abort();
-    case bit: return data[0] ? QVariant(true) : QVariant(false);
-    case uint16: return parseWords<uint16_t>(reg.packing, data);
-    case uint32: return parseWords<uint32_t>(reg.packing, data);
-    case float32: return parseWords<float>(reg.packing, data);
+    *level = value;
+}
+
+//! native value words -> register words, inverse of unpackWords() for one value
+static void applyPacking(uint16_t* words, int n, RegisterPacking pack) {
+    auto self = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? little : big;
+    if (n > 1 && self != pack.word) {
+        std::reverse(words, words + n);
+    }
+    for (int i = 0; i < n; ++i) {
+        if (pack.byte == little) {
+            words[i] = qToLittleEndian(words[i]);
+        } else {
+            words[i] = qToBigEndian(words[i]);
+        }
     }
-    return {};
 }
 
+template<typename T>
+static void appendValue(QVector<uint16_t>& words, T v, RegisterPacking pack) {
+    static_assert(sizeof(T) % 2 == 0);
+    auto at = words.size();
+    words.resize(at + qsizetype(sizeof(T) / 2));
+    memcpy(words.data() + at, &v, sizeof(T));
+    applyPacking(words.data() + at, int(sizeof(T) / 2), pack);
+}
+
+//! appends a single value of `type`
 [[maybe_unused]]
-static bool encodeRegister(PreparedRegister const& reg, QVariant const& v, QVector<uint16_t>& words) {
-    words.clear();
-    switch (reg.type) {
+static bool encodeValue(RegisterValueType type, RegisterPacking packing, QVariant const& v, QVector<uint16_t>& words) {
+    bool ok = true;
+    switch (type) {
     case defaultValueType:
         assert(false && "lib error");
         std::abort();
@@ -311,39 +565,116 @@ static bool encodeRegister(PreparedRegister const& reg, QVariant const& v, QVect
         return true;
     }
     case uint16: {
-        bool ok;
         auto ui = v.toUInt(&ok);
         if (!ok || ui > (std::numeric_limits<uint16_t>::max)()) {
             return false;
         }
-        words.push_back(uint16_t(ui));
-        applyPacking(words, reg.packing);
+        appendValue(words, uint16_t(ui), packing);
+        return true;
+    }
+    case int16: {
+        auto i = v.toInt(&ok);
+        if (!ok || i < (std::numeric_limits<int16_t>::min)() || i > (std::numeric_limits<int16_t>::max)()) {
+            return false;
+        }
+        appendValue(words, int16_t(i), packing);
         return true;
     }
     case uint32: {
-        bool ok;
         uint32_t ui = v.toUInt(&ok);
         if (!ok) {
             return false;
         }
-        words.resize(2);
-        memcpy(words.data(), &ui, sizeof(ui));
-        applyPacking(words, reg.packing);
+        appendValue(words, ui, packing);
+        return true;
+    }
+    case int32: {
+        int32_t i = v.toInt(&ok);
+        if (!ok) {
+            return false;
+        }
+        appendValue(words, i, packing);
         return true;
     }
     case float32: {
-        bool ok;
         float f = v.toFloat(&ok);
         if (!ok) {
             return false;
         }
-        words.resize(2);
-        memcpy(words.data(), &f, sizeof(f));
-        applyPacking(words, reg.packing);
+        appendValue(words, f, packing);
+        return true;
+    }
+    case float64: {
+        double d = v.toDouble(&ok);
+        if (!ok) {
+            return false;
+        }
+        appendValue(words, d, packing);
         return true;
     }
     }
     return false;
 }
 
+//! blocks take a list of `count` values, or raw native bytes for `format = "bytes"`
+[[maybe_unused]]
+static bool encodeRegister(PreparedRegister const& reg, QVariant const& v, QVector<uint16_t>& words) {
+    words.clear();
+    if (!reg.count) {
+        return encodeValue(reg.type, reg.packing, v, words);
+    }
+    words.reserve(reg.sizeOf / 2);
+    if (v.metaType().id() == QMetaType::QByteArray) {
+        auto bytes = v.toByteArray();
+        if (reg.type == bit) {
+            if (bytes.size() != qsizetype(reg.count)) return false;
+            for (auto b: bytes) {
+                words.push_back(uint16_t(b ? 1 : 0));
+            }
+            return true;
+        }
+        if (bytes.size() != reg.sizeOf) return false;
+        auto elem = getSizeOf(reg.type) / 2;
+        words.resize(reg.sizeOf / 2);
+        memcpy(words.data(), bytes.constData(), size_t(bytes.size()));
+        for (int i = 0; i < words.size(); i += elem) {
+            applyPacking(words.data() + i, elem, reg.packing);
+        }
+        return true;
+    }
+    auto list = v.toList();
+    if (list.size() != qsizetype(reg.count)) {
+        return false;
+    }
+    for (auto& item: list) {
+        if (!encodeValue(reg.type, reg.packing, item, words)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! "key" or "key:[N]" (element N of a block)
+[[maybe_unused]]
+static PreparedWriteRegister const* findWritable(PreparedWrites const& regs, string const& key, int& element) {
+    element = -1;
+    if (auto it = regs.find(key); it != regs.end()) {
+        return &it->second;
+    }
+    auto split = key.rfind(':');
+    if (split == string::npos) {
+        return nullptr;
+    }
+    auto idx = tryInt(string_view(key).substr(split + 1));
+    if (idx < 0) {
+        return nullptr;
+    }
+    auto it = regs.find(key.substr(0, split));
+    if (it == regs.end() || idx >= long(it->second.count)) {
+        return nullptr;
+    }
+    element = int(idx);
+    return &it->second;
+}
+
 }
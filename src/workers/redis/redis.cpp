@@ -7,10 +7,90 @@
 #include <QFile>
 #include <qcoreapplication.h>
 #include <set>
+#include <deque>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include "radapter/async_helpers.hpp"
+#include "workers/wire.hpp"
 
 namespace radapter::redis {
 
+enum ValueEncoding {
+    enc_string,
+    enc_msgpack,
+};
+
+RAD_DESCRIBE(ValueEncoding) {
+    MEMBER("string", enc_string);
+    MEMBER("msgpack", enc_msgpack);
+}
+
+// msgpack keeps value types and may hold whole subtrees (see field_depth)
+static string encodeValue(ValueEncoding enc, QVariant const& v) {
+    if (enc == enc_msgpack) {
+        return wire::Encode(wire::msgpack, std::nullopt, v).toStdString();
+    }
+    return v.toString().toStdString();
+}
+
+static QVariant decodeValue(ValueEncoding enc, QByteArray const& raw, Worker* self) {
+    if (enc == enc_msgpack) {
+        return wire::Decode(wire::msgpack, std::nullopt, raw, [&](QString const& err){
+            self->Warn("could not decode msgpack value: {}", err);
+        });
+    }
+    return TextOrBytes(raw);
+}
+
+static void splitFields(FlatMap& out, QVariant const& v, unsigned depth, string prefix) {
+    if (!depth || v.metaType().id() != QMetaType::QVariantMap) {
+        out.push_back({std::move(prefix), v});
+        return;
+    }
+    auto& map = *static_cast<const QVariantMap*>(v.constData());
+    for (auto it = map.cbegin(); it != map.cend(); ++it) {
+        auto key = it.key().toStdString();
+        splitFields(out, it.value(), depth - 1, prefix.empty() ? std::move(key) : prefix + ':' + key);
+    }
+}
+
+// depth 0: one field per leaf, else maps are split `depth` levels deep and deeper values kept whole
+static void toFields(FlatMap& out, QVariant const& msg, unsigned depth) {
+    if (!depth) {
+        Flatten(out, msg);
+    } else {
+        splitFields(out, msg, depth, {});
+    }
+}
+
+template<typename Conf>
+static void validateEncoding(Conf const& conf) {
+    if (conf.field_depth && conf.encoding != enc_msgpack) {
+        Raise("field_depth needs encoding = \"msgpack\"");
+    }
+}
+
+// workers on a shared connection take its server settings instead of their own
+template<typename Conf>
+static Conf& withConnection(Conf& conf) {
+    if (conf.connection) {
+        auto& shared = (*conf.connection)->Settings();
+        conf.host = shared.host;
+        conf.port = shared.port;
+        conf.db = shared.db;
+        conf.reconnect_timeout = shared.reconnect_timeout;
+        conf.protocol = shared.protocol;
+    }
+    return conf;
+}
+
+static QString defaultName(Config const& conf, string const& key) {
+    return QString("%1:%2/%3")
+        .arg(conf.host.value.c_str())
+        .arg(conf.port.value)
+        .arg(key.c_str());
+}
+
 enum CacheMode {
     r = 1,
     w = 2,
@@ -26,10 +106,36 @@ RAD_DESCRIBE(CacheMode) {
     MEMBER("read_write", rw);
 }
 
+enum CacheSync {
+    sync_full,
+    sync_changes,
+};
+
+RAD_DESCRIBE(CacheSync) {
+    MEMBER("full", sync_full);
+    MEMBER("changes", sync_changes);
+}
+
 struct CacheConfig : Config {
     optional<string> hash_key;
     WithDefault<bool> enable_keyevents = true;
     WithDefault<CacheMode> mode = rw;
+    // write-behind: collect fields for flush_interval ms and/or up to max_batch fields
+    // (last value wins), then write them with one HSET. Both 0: every message is written at once
+    WithDefault<unsigned> flush_interval = 0u;
+    WithDefault<unsigned> max_batch = 0u;
+    // fields set to nil are removed with HDEL instead of written as empty strings
+    WithDefault<bool> delete_invalid = false;
+    // full: HGETALL on keyevents of the hash (debounced by poll_debounce ms).
+    // changes: writers publish changed fields as a JSON object to changes_channel
+    // ("<hash_key>:changes" by default), HGETALL only on (re)connect
+    WithDefault<CacheSync> sync = sync_full;
+    optional<string> changes_channel;
+    WithDefault<unsigned> poll_debounce = 0u;
+    WithDefault<ValueEncoding> encoding = enc_string;
+    WithDefault<unsigned> field_depth = 0u;
+    // RedisConnection to share: host, port, db, protocol come from it
+    optional<Connection*> connection;
 };
 
 RAD_DESCRIBE(CacheConfig) {
@@ -37,6 +143,15 @@ RAD_DESCRIBE(CacheConfig) {
     RAD_MEMBER(hash_key);
     RAD_MEMBER(enable_keyevents);
     RAD_MEMBER(mode);
+    RAD_MEMBER(flush_interval);
+    RAD_MEMBER(max_batch);
+    RAD_MEMBER(delete_invalid);
+    RAD_MEMBER(sync);
+    RAD_MEMBER(changes_channel);
+    RAD_MEMBER(poll_debounce);
+    RAD_MEMBER(encoding);
+    RAD_MEMBER(field_depth);
+    RAD_MEMBER(connection);
 }
 
 enum StreamStart {
@@ -59,6 +174,22 @@ struct StreamConfig : Config {
     WithDefault<string> instance_id = "_";
     WithDefault<string> persistent_prefix = "__radapter";
     WithDefault<CacheMode> mode = rw;
+    // reads grow up to this while every read returns a full batch (catching up)
+    WithDefault<unsigned> max_entries_per_read = 10'000u;
+    // consumer group mode: XREADGROUP as `consumer` (default: instance_id), entries are XACKed
+    // after being sent on, pending ones idle for claim_idle_ms are claimed on start
+    optional<string> group;
+    optional<string> consumer;
+    WithDefault<unsigned> claim_idle_ms = 60'000u;
+    // writes: queue entries for flush_interval ms and/or up to max_batch entries, then send
+    // them as one pipelined block of XADDs. emit_ids: {ids = {...}} event per block
+    WithDefault<unsigned> flush_interval = 0u;
+    WithDefault<unsigned> max_batch = 0u;
+    WithDefault<bool> emit_ids = false;
+    WithDefault<ValueEncoding> encoding = enc_string;
+    WithDefault<unsigned> field_depth = 0u;
+    // writes and XACKs use its pool, blocking reads still need a connection of their own
+    optional<Connection*> connection;
 };
 
 RAD_DESCRIBE(StreamConfig) {
@@ -71,6 +202,16 @@ RAD_DESCRIBE(StreamConfig) {
     RAD_MEMBER(instance_id);
     RAD_MEMBER(persistent_prefix);
     RAD_MEMBER(mode);
+    RAD_MEMBER(max_entries_per_read);
+    RAD_MEMBER(group);
+    RAD_MEMBER(consumer);
+    RAD_MEMBER(claim_idle_ms);
+    RAD_MEMBER(flush_interval);
+    RAD_MEMBER(max_batch);
+    RAD_MEMBER(emit_ids);
+    RAD_MEMBER(encoding);
+    RAD_MEMBER(field_depth);
+    RAD_MEMBER(connection);
 }
 
 class Cache : public Worker
@@ -82,38 +223,128 @@ class Cache : public Worker
     Client* sub_client = nullptr;
     QVariant state;
     QString preped_hash_key;
+    //! field -> value not written yet, nullopt: HDEL
+    std::map<string, optional<QVariant>> pending;
+    QTimer* flushTimer = nullptr;
+    string changesChannel;
+    QTimer* pollTimer = nullptr;
+    bool polling = false;
+    bool pollAgain = false; // keyevents arrived while HGETALL was in flight
+    //! RESP3 + full sync: invalidations of CLIENT TRACKING replace keyevents and sub_client
+    bool tracking = false;
+    bool listening = false; // shared connection: the subscription outlives reconnects
+    std::map<QString, Script> scripts; // by source, see Eval()
 public:
     Cache(CacheConfig conf, Instance* inst) :
         Worker(inst,
-               EnsureName(conf, QString("%1:%2/%3")
-                                    .arg(conf.host.value.c_str())
-                                    .arg(conf.port.value)
-                                    .arg(conf.hash_key ? conf.hash_key->c_str() : "-")),
+               EnsureName(conf, defaultName(withConnection(conf), conf.hash_key.value_or("-"))),
                "redis")
     {
         config = std::move(conf);
+        validateEncoding(config);
         preped_hash_key = QString::fromStdString(config.hash_key.value_or(""));
-        client = new Client(config, this);
-        sub_client = new Client(config, this);
-        client->setObjectName(objectName());
-        sub_client->setObjectName(objectName() + "_sub");
-        connect(client, &Client::Error, this, [=](QString err){
-            Error("Error: {}", err);
+        changesChannel = config.changes_channel.value_or(config.hash_key.value_or("") + ":changes");
+        pollTimer = new QTimer(this);
+        pollTimer->setSingleShot(true);
+        pollTimer->setInterval(int(config.poll_debounce));
+        pollTimer->callOnTimeout(this, &Cache::poll);
+        tracking = config.protocol == 3u && config.sync == sync_full;
+        if (config.connection) {
+            client = (*config.connection)->Commands();
+            if ((config.mode & r) && !tracking) {
+                sub_client = (*config.connection)->PubSub();
+            }
+        } else {
+            client = new Client(config, this);
+            sub_client = new Client(config, this);
+            client->setObjectName(objectName());
+            sub_client->setObjectName(objectName() + "_sub");
+            connect(client, &Client::Error, this, [=](QString err){
+                Error("Error: {}", err);
+            });
+        }
+        connect(client, &Client::Push, this, [=](QVariantList msg){
+            if (msg.value(0) != "invalidate") return;
+            // nil: the server flushed all tracked keys
+            auto keys = msg.value(1);
+            if (!keys.isValid() || keys.toStringList().contains(preped_hash_key)) {
+                schedulePoll();
+            }
         });
-        auto onConnected = [=]{
-            bool ok = client->IsConnected() && sub_client->IsConnected();
-            if (ok && config.hash_key) {
-                subscribeToHash();
+        connect(client, &Client::ConnectedChanged, this, &Cache::onConnected);
+        if (config.flush_interval || config.max_batch) {
+            // max_batch alone: messages handled in the same event loop turn are merged
+            flushTimer = new QTimer(this);
+            flushTimer->setSingleShot(true);
+            flushTimer->setInterval(int(config.flush_interval));
+            flushTimer->callOnTimeout(this, &Cache::flush);
+        }
+        if ((config.mode & r) && !tracking) {
+            connect(sub_client, &Client::ConnectedChanged, this, &Cache::onConnected);
+        }
+        if (config.connection) {
+            // shared clients may be up already
+            onConnected();
+        } else {
+            client->Start();
+            if ((config.mode & r) && !tracking) {
+                sub_client->Start();
+            }
+        }
+    }
+    void onConnected() {
+        bool ok = client->IsConnected() && (tracking || (sub_client && sub_client->IsConnected()));
+        if (ok && config.hash_key && (config.mode & r)) {
+            subscribeToHash();
+        }
+    }
+    // own connections are restarted, shared ones stay up for the other workers
+    void retryLater() {
+        if (config.connection) {
+            QTimer::singleShot(int(config.reconnect_timeout), this, &Cache::onConnected);
+        } else {
+            client->ReconnectLater();
+            if (sub_client) {
+                sub_client->ReconnectLater();
             }
-        };
-        connect(client, &Client::ConnectedChanged, this, onConnected);
-        client->Start();
-        if (config.mode & r) {
-            connect(sub_client, &Client::ConnectedChanged, this, onConnected);
-            sub_client->Start();
+        }
+    }
+    // `subscribed`: once messages on `glob` are delivered, again after the subscription
+    // is renewed. A shared subscription is made once and may be confirmed already
+    void listen(string const& glob, Client::Subscriber sub, std::function<void()> subscribed) {
+        if (!config.connection) {
+            sub_client->PSubscribe(glob, std::move(sub), std::move(subscribed));
+        } else if (!listening) {
+            listening = true;
+            (*config.connection)->PSubscribe(glob, this, std::move(sub), std::move(subscribed));
+        } else {
+            subscribed();
         }
     }
     void subscribeToHash() {
+        if (tracking) {
+            // HGETALL on this connection arms the invalidation of the hash key
+            client->Execute({"CLIENT", "TRACKING", "ON"})
+                .ThenSync([this](QVariant){
+                    poll();
+                })
+                .CatchSync([this, ref = QPointer(this)](std::exception& e){
+                    if (!ref) return;
+                    Error("Could not enable client tracking: {}", e.what());
+                    retryLater();
+                });
+            return;
+        }
+        // HGETALL only after the subscription is confirmed: a change published
+        // in between is then either in the snapshot or delivered afterwards
+        if (config.sync == sync_changes) {
+            listen(changesChannel, [this](Client::SubEvent ev){
+                applyChanges(ev.message);
+            }, [this]{
+                poll();
+            });
+            return;
+        }
         client->Execute({"CONFIG", "GET", "notify-keyspace-events"})
             .ThenSync([this](QVariant res){
                 auto modes = res.toString().toStdString();
@@ -134,46 +365,97 @@ public:
             })
             .ThenSync([this](QVariant res){
                 if (res != "OK") Raise("Could not enable keyevent notifications");
-                poll();
-                sub_client->PSubscribe(fmt::format("__keyevent@{}__:*", config.db), [this](Client::SubEvent ev){
+                listen(fmt::format("__keyevent@{}__:*", config.db), [this](Client::SubEvent ev){
                     if (ev.message != preped_hash_key) return;
+                    schedulePoll();
+                }, [this]{
                     poll();
                 });
             })
             .CatchSync([this, ref = QPointer(this)](std::exception& e){
                 if (!ref) return;
                 Error("Could not subscribe to hash: {}", e.what());
-                sub_client->ReconnectLater();
-                client->ReconnectLater();
+                retryLater();
             });
     }
+    // a burst of keyevents results in at most one HGETALL in flight and one queued
+    void schedulePoll() {
+        if (polling) {
+            pollAgain = true;
+        } else if (!pollTimer->isActive()) {
+            pollTimer->start();
+        }
+    }
     void poll() {
         assert(config.hash_key);
-        client->Execute({"HGETALL", *config.hash_key})
-            .ThenSync([this](QVariant resp){
-                if (resp.metaType().id() != QMetaType::QVariantList) {
-                    Error("error reading all keys: {}", resp.toString());
-                    return;
-                }
-                auto list = resp.toList();
-                auto size = list.size();
-                size ^= size & 1; //make even
-                FlatMap flat;
-                for (auto i = 0; i < size; i += 2) {
-                    flat.push_back({list[i].toString().toStdString(), list[i+1]});
+        polling = true;
+        RedisCmd cmd("HGETALL");
+        cmd.Arg(*config.hash_key);
+        cmd.raw = true;
+        client->Execute(cmd)
+            .AtLastSync([this, ref = QPointer(this)](Result<QVariant> res) mutable noexcept {
+                if (!ref) return;
+                polling = false;
+                try {
+                    applyAll(res.get());
+                } catch (std::exception& e) {
+                    Error("Could not read hash {} => {}", *config.hash_key, e.what());
                 }
-                QVariant unflat;
-                Unflatten(unflat, flat);
-                QVariant diff;
-                if (MergePatch(state, unflat, &diff)) {
-                    emit SendMsg(diff);
+                if (pollAgain) {
+                    pollAgain = false;
+                    schedulePoll();
                 }
-            })
-            .CatchSync([this, ref = QPointer(this)](std::exception& e) {
-                if (!ref) return;
-                Error("Could not read hash {} => {}", *config.hash_key, e.what());
             });
-
+    }
+    // RESP2: flat [field, value, ...] list, RESP3: {field: value} map
+    void applyAll(QVariant const& resp) {
+        if (resp.metaType().id() == QMetaType::QVariantMap) {
+            auto map = resp.toMap();
+            FlatMap flat;
+            flat.reserve(size_t(map.size()));
+            for (auto it = map.cbegin(); it != map.cend(); ++it) {
+                flat.push_back({it.key().toStdString(), decodeValue(config.encoding, it.value().toByteArray(), this)});
+            }
+            apply(flat);
+            return;
+        }
+        if (resp.metaType().id() != QMetaType::QVariantList) {
+            Error("error reading all keys: {}", resp.toString());
+            return;
+        }
+        auto list = resp.toList();
+        auto size = list.size();
+        size ^= size & 1; //make even
+        FlatMap flat;
+        flat.reserve(size_t(size / 2));
+        for (auto i = 0; i < size; i += 2) {
+            flat.push_back({list[i].toByteArray().toStdString(), decodeValue(config.encoding, list[i+1].toByteArray(), this)});
+        }
+        apply(flat);
+    }
+    // {"field": "value" | null, ...}, see flush()
+    void applyChanges(QString const& msg) {
+        auto doc = QJsonDocument::fromJson(msg.toUtf8());
+        if (!doc.isObject()) {
+            Warn("{}: not a JSON object: {}", changesChannel, msg);
+            return;
+        }
+        auto obj = doc.object();
+        FlatMap flat;
+        for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
+            // typed as published: radapter writers send strings unless in msgpack mode
+            auto v = it.value();
+            flat.push_back({it.key().toStdString(), v.isNull() ? QVariant{} : v.toVariant()});
+        }
+        apply(flat);
+    }
+    void apply(FlatMap const& flat) {
+        QVariant unflat;
+        Unflatten(unflat, flat);
+        QVariant diff;
+        if (MergePatch(state, unflat, &diff)) {
+            emit SendMsg(diff);
+        }
     }
     void OnMsg(QVariant const& msg) override {
         if (!(config.mode & w)) {
@@ -185,23 +467,71 @@ public:
             return;
         }
         FlatMap flat;
-        Flatten(flat, msg);
-        RedisCmd cmd("HMSET");
-        cmd.Arg(*config.hash_key);
+        toFields(flat, msg, config.field_depth);
         for (auto& [k, v]: flat) {
-            cmd.Arg(k);
-            cmd.Temp(v.toString().toStdString());
+            if (!v.isValid() && config.delete_invalid) {
+                pending[k] = std::nullopt;
+            } else {
+                pending[k] = std::move(v);
+            }
         }
-        client->Execute(cmd)
-            .ThenSync([this](QVariant resp){
-                if (resp != "OK") {
-                    Error("non-ok responce: {}", resp.toString());
+        if (pending.empty()) {
+            return;
+        }
+        if (!flushTimer || (config.max_batch && pending.size() >= config.max_batch)) {
+            flush();
+        } else if (!flushTimer->isActive()) {
+            flushTimer->start();
+        }
+    }
+    // HSET and HDEL are sent back to back on one connection, so they share a round trip
+    void flush() {
+        if (flushTimer) {
+            flushTimer->stop();
+        }
+        if (pending.empty()) {
+            return;
+        }
+        RedisCmd set("HSET");
+        RedisCmd del("HDEL");
+        set.Arg(*config.hash_key);
+        del.Arg(*config.hash_key);
+        QJsonObject changes;
+        for (auto& [k, v]: pending) {
+            if (!v) {
+                del.Temp(string{k});
+                if (config.sync == sync_changes) {
+                    changes[QString::fromStdString(k)] = QJsonValue();
                 }
-            })
-            .CatchSync([this, ref = QPointer(this)](std::exception& e){
-                if (!ref) return;
-                Error("error writing: {}", e.what());
-            });
+                continue;
+            }
+            auto encoded = encodeValue(config.encoding, *v);
+            if (config.sync == sync_changes) {
+                // typed in msgpack mode, readers compare the same strings as in the hash otherwise
+                changes[QString::fromStdString(k)] = config.encoding == enc_msgpack
+                                                         ? QJsonValue::fromVariant(*v)
+                                                         : QJsonValue(QString::fromStdString(encoded));
+            }
+            set.Temp(string{k});
+            set.Temp(std::move(encoded));
+        }
+        pending.clear();
+        auto onError = [this, ref = QPointer(this)](std::exception& e){
+            if (!ref) return;
+            Error("error writing: {}", e.what());
+        };
+        if (set.Size() > 2) {
+            client->Execute(set).CatchSync(onError);
+        }
+        if (del.Size() > 2) {
+            client->Execute(del).CatchSync(onError);
+        }
+        if (config.sync == sync_changes) {
+            RedisCmd pub("PUBLISH");
+            pub.Arg(changesChannel);
+            pub.Temp(QJsonDocument(changes).toJson(QJsonDocument::Compact).toStdString());
+            client->Execute(pub).CatchSync(onError);
+        }
     }
 
     // 1: Exec(cmd, function (ok, err) ... end) -> nil
@@ -231,6 +561,24 @@ public:
             return {};
         }
     }
+
+    // 1: Eval(script, {keys...}, {args...}, function (ok, err) ... end) -> nil
+    // 1a: Eval(script, {keys...}, {args...}) -> async thunk with (ok, err)
+    QVariant Eval(QVariantList args) {
+        auto source = args.value(0).toString();
+        auto it = scripts.find(source);
+        if (it == scripts.end()) {
+            it = scripts.emplace(source, Script(source.toUtf8())).first;
+        }
+        auto future = it->second.Run(client, args.value(1).toList(), args.value(2).toList());
+        if (args.size() < 4) {
+            return makeLuaPromise(this, future);
+        } else {
+            LuaFunction cb = args.value(3).value<LuaFunction>();
+            resolveLuaCallback(this, future, cb);
+            return {};
+        }
+    }
 };
 
 class Stream : public Worker
@@ -243,6 +591,14 @@ class Stream : public Worker
     string lastId;
 
     string lastIdKey;
+    unsigned count = 0; // current entries per read, see adaptCount()
+    //! group mode: own pending entries after lastId until a read returns none, then claiming idle ones, then ">"
+    enum GroupStage { own_pending, claiming, fresh } stage = own_pending;
+    string claimCursor = "0-0";
+    string consumer;
+    //! XADDs not sent yet; a deque, so queued commands are never moved (RedisCmd holds views)
+    std::deque<RedisCmd> queued;
+    QTimer* flushTimer = nullptr;
 public:
     void saveLastId() {
         client->Execute({"SET", lastIdKey, lastId})
@@ -270,47 +626,111 @@ public:
     }
     Stream(StreamConfig conf, Instance* inst) :
         Worker(inst,
-               EnsureName(conf, QString("%1:%2/%3")
-                                    .arg(conf.host.value.c_str())
-                                    .arg(conf.port.value)
-                                    .arg(conf.stream_key.c_str())),
+               EnsureName(conf, defaultName(withConnection(conf), conf.stream_key)),
                "redis")
     {
         config = std::move(conf);
+        if (!config.entries_per_read || config.max_entries_per_read < config.entries_per_read) {
+            Raise("entries_per_read must be in range 1-max_entries_per_read");
+        }
+        validateEncoding(config);
+        count = config.entries_per_read;
+        consumer = config.consumer.value_or(config.instance_id.value);
+        if (config.flush_interval || config.max_batch) {
+            flushTimer = new QTimer(this);
+            flushTimer->setSingleShot(true);
+            flushTimer->setInterval(int(config.flush_interval));
+            flushTimer->callOnTimeout(this, &Stream::flush);
+        }
         lastIdKey = fmt::format(
             "{}:{}:{}:last_id",
             config.persistent_prefix.value,
             config.instance_id.value,
             config.stream_key);
-        client = new Client(config, this);
-        client->setObjectName(objectName());
-        client->Start();
+        if (config.connection) {
+            client = (*config.connection)->Commands();
+        } else {
+            client = new Client(config, this);
+            client->setObjectName(objectName());
+            client->Start();
+        }
         if (config.mode & r) {
             read_client = new Client(config, this);
             read_client->setObjectName(objectName()+"_read");
             read_client->Start();
             connect(read_client, &Client::ConnectedChanged, this, [this](bool state){
-                if (state) {
-                    if (config.start_from == persistent_id) {
-                        loadIdAndRead();
+                if (!state) {
+                    return;
+                }
+                if (config.group) {
+                    createGroup();
+                } else if (config.start_from == persistent_id) {
+                    loadIdAndRead();
+                } else {
+                    if (config.start_from == start) {
+                        lastId = "0-0";
                     } else {
-                        if (config.start_from == start) {
-                            lastId = "0-0";
-                        } else {
-                            lastId = "$";
-                        }
-                        nextRead();
+                        lastId = "$";
                     }
+                    nextRead();
                 }
             });
         }
     }
+    // the group keeps its own position: start_from only matters when it is created
+    void createGroup() {
+        read_client->Execute({"XGROUP", "CREATE", config.stream_key, *config.group,
+                              config.start_from == start ? "0" : "$", "MKSTREAM"})
+            .AtLastSync([this, ref = QPointer(this)](Result<QVariant> res) mutable noexcept {
+                if (!ref) return;
+                try {
+                    res.get();
+                    Info("created consumer group '{}'", *config.group);
+                } catch (std::exception& e) {
+                    if (string_view(e.what()).substr(0, 9) != "BUSYGROUP") {
+                        Error("Could not create consumer group '{}': {}", *config.group, e.what());
+                        read_client->ReconnectLater();
+                        return;
+                    }
+                }
+                stage = own_pending;
+                lastId = "0-0";
+                claimCursor = "0-0";
+                nextRead();
+            });
+    }
     void nextRead() {
-        read_client
-            ->Execute({"XREAD", "COUNT", std::to_string(config.entries_per_read.value),
-                 "BLOCK", std::to_string(config.block_timeout.value),
-                 "STREAMS", config.stream_key, lastId,
-            })
+        RedisCmd cmd;
+        if (config.group && stage == claiming) {
+            cmd.Arg("XAUTOCLAIM");
+            cmd.Arg(config.stream_key);
+            cmd.Arg(*config.group);
+            cmd.Arg(consumer);
+            cmd.Temp(std::to_string(config.claim_idle_ms.value));
+            cmd.Arg(claimCursor);
+        } else if (config.group) {
+            cmd.Arg("XREADGROUP");
+            cmd.Arg("GROUP");
+            cmd.Arg(*config.group);
+            cmd.Arg(consumer);
+        } else {
+            cmd.Arg("XREAD");
+        }
+        cmd.Arg("COUNT");
+        cmd.Temp(std::to_string(count));
+        if (!config.group || stage == fresh) {
+            cmd.Arg("BLOCK");
+            cmd.Temp(std::to_string(config.block_timeout.value));
+        }
+        if (!config.group || stage != claiming) {
+            cmd.Arg("STREAMS");
+            cmd.Arg(config.stream_key);
+            // own pending entries are paged by id: acks of the last batch may still be in flight
+            cmd.Arg(!config.group || stage == own_pending ? string_view{lastId} : ">");
+        }
+        // ids and field names go straight to std::string, only values are decoded
+        cmd.raw = true;
+        read_client->Execute(cmd)
             .AtLastSync([this, ref = QPointer(this)](Result<QVariant> resp){
                 if (!ref) return;
                 try {
@@ -321,32 +741,82 @@ public:
                 }
             });
     }
+    // XREAD(GROUP): [[key, entries]] (RESP3: {key: entries}), XAUTOCLAIM: [cursor, entries, deleted]
     void parseReply(QVariant resp) {
-        if (!resp.isValid())
+        if (!resp.isValid()) {
+            if (config.group && stage == own_pending) stage = claiming;
             return;
-        if (resp.metaType().id() != QMetaType::QVariantList) {
+        }
+        QVariantList entries;
+        if (config.group && stage == claiming) {
+            auto list = resp.toList();
+            claimCursor = list.value(0).toByteArray().toStdString();
+            entries = list.value(1).toList();
+            if (claimCursor.empty() || claimCursor == "0-0") {
+                stage = fresh;
+            }
+        } else if (resp.metaType().id() == QMetaType::QVariantMap) {
+            auto byKey = resp.toMap();
+            entries = byKey.isEmpty() ? QVariantList{} : byKey.first().toList();
+        } else if (resp.metaType().id() == QMetaType::QVariantList) {
+            entries = resp.toList().value(0).toList().value(1).toList();
+        } else {
             Error("error reading stream: non list received {}", resp.typeName() ? resp.typeName() : "<unk>");
             return;
         }
-        auto entries = resp.toList().value(0).toList().value(1).toList();
+        RedisCmd ack("XACK");
+        if (config.group) {
+            ack.Arg(config.stream_key);
+            ack.Arg(*config.group);
+        }
         for (auto& e: entries) {
             auto pair = e.toList();
-            auto nextId = pair.value(0).toString().toStdString();
+            auto nextId = pair.value(0).toByteArray().toStdString();
+            auto fields = pair.value(1).toList();
             if (!nextId.empty()) {
+                if (config.group) {
+                    ack.Temp(string{nextId});
+                }
                 lastId = std::move(nextId);
             }
-            auto fields = pair.value(1).toList();
             auto size = fields.size();
             size ^= size & 1;
+            if (!size) {
+                continue; // deleted while pending
+            }
             FlatMap values;
+            values.reserve(size_t(size / 2));
             for (auto i = 0; i < size; i += 2) {
-                values.push_back({fields[i].toString().toStdString(), fields[i+1]});
+                values.push_back({fields[i].toByteArray().toStdString(), decodeValue(config.encoding, fields[i+1].toByteArray(), this)});
             }
             QVariant unflat;
             Unflatten(unflat, values);
             emit SendMsg(unflat);
         }
-        saveLastId();
+        if (config.group && stage == own_pending && entries.isEmpty()) {
+            stage = claiming;
+        }
+        if (stage != claiming) {
+            adaptCount(unsigned(entries.size()));
+        }
+        if (!config.group) {
+            saveLastId();
+        } else if (ack.Size() > 3) {
+            // sent on the other connection, the next read does not wait for it
+            client->Execute(ack).CatchSync([this, ref = QPointer(this)](std::exception& e){
+                if (!ref) return;
+                Error("Could not ack entries: {}", e.what());
+            });
+        }
+    }
+    //! full batches mean a backlog: double the batch size up to max_entries_per_read,
+    //! shrink back towards entries_per_read once reads return little
+    void adaptCount(unsigned got) {
+        if (got >= count) {
+            count = (std::min)(count * 2, config.max_entries_per_read.value);
+        } else if (got < count / 4) {
+            count = (std::max)(count / 2, config.entries_per_read.value);
+        }
     }
     void OnMsg(QVariant const& msg) override {
         if (!(config.mode & w)) {
@@ -354,34 +824,75 @@ public:
             return;
         }
         FlatMap flat;
-        Flatten(flat, msg);
-        RedisCmd cmd("XADD");
+        toFields(flat, msg, config.field_depth);
+        auto& cmd = queued.emplace_back("XADD");
         cmd.Arg(config.stream_key);
+        // '~': redis trims whole macro nodes, exact MAXLEN would cut into them on every add
         cmd.Arg("MAXLEN");
         cmd.Arg("~");
         cmd.Temp(std::to_string(config.stream_size.value));
         cmd.Arg("*");
         for (auto& [k, v]: flat) {
-            cmd.Arg(k);
-            cmd.Temp(v.toString().toStdString());
+            cmd.Temp(std::move(k));
+            cmd.Temp(encodeValue(config.encoding, v));
+        }
+        if (!flushTimer || (config.max_batch && queued.size() >= config.max_batch)) {
+            flush();
+        } else if (!flushTimer->isActive()) {
+            flushTimer->start();
         }
-        client->Execute(cmd).CatchSync([this, ref = QPointer(this)](std::exception& e){
-            if (!ref) return;
-            Error("could not write stream: {}", e.what());
-        });
+    }
+    // all commands are issued in one go, hiredis writes them out together
+    void flush() {
+        if (flushTimer) {
+            flushTimer->stop();
+        }
+        if (queued.empty()) {
+            return;
+        }
+        auto total = queued.size();
+        auto ids = config.emit_ids ? std::make_shared<QVariantList>(qsizetype(total)) : nullptr;
+        auto left = std::make_shared<size_t>(total);
+        for (size_t i = 0; i < total; ++i) {
+            client->Execute(queued[i])
+                .AtLastSync([this, ref = QPointer(this), ids, left, i](Result<QVariant> res) mutable noexcept {
+                    if (!ref) return;
+                    try {
+                        auto id = res.get();
+                        if (ids) (*ids)[qsizetype(i)] = std::move(id);
+                    } catch (std::exception& e) {
+                        Error("could not write stream: {}", e.what());
+                    }
+                    if (--*left == 0 && ids) {
+                        emit SendEvent(QVariantMap{{"ids", *ids}});
+                    }
+                });
+        }
+        queued.clear();
     }
 };
 
+static QVariant makeConnection(Instance* inst, QVariantList args) {
+    ConnectionConfig conf;
+    Parse(conf, args.value(0));
+    QObject* conn = new Connection(std::move(conf), inst);
+    return QVariant::fromValue(conn);
+}
+
 }
 
 void radapter::builtin::workers::redis(Instance* inst) {
     inst->RegisterWorker<redis::Cache>("RedisCache", {
         {"Exec", AsExtraMethod<&redis::Cache::Exec>},
+        {"Eval", AsExtraMethod<&redis::Cache::Eval>},
     });
     inst->RegisterSchema("RedisCache", SchemaFor<redis::CacheConfig>);
 
     inst->RegisterWorker<redis::Stream>("RedisStream");
     inst->RegisterSchema("RedisStream", SchemaFor<redis::StreamConfig>);
+
+    inst->RegisterFunc("RedisConnection", redis::makeConnection);
+    inst->RegisterSchema("RedisConnection", SchemaFor<redis::ConnectionConfig>);
 }
 
 #include "redis.moc"
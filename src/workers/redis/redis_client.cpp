@@ -2,57 +2,119 @@
 #include "fmt/compile.h"
 #include "qtadapter.hpp"
 #include <QTimer>
+#include <QStringDecoder>
+#include <QCryptographicHash>
+#include <algorithm>
 #include "redis_inc.h"
 
 using namespace radapter;
 using namespace radapter::redis;
 
-static QVariant parseReply(redisReply* reply)
+QVariant radapter::redis::TextOrBytes(const char* str, size_t len)
+{
+    QStringDecoder utf8(QStringDecoder::Utf8, QStringDecoder::Flag::Stateless);
+    QString text = utf8.decode(QByteArrayView(str, qsizetype(len)));
+    if (utf8.hasError()) {
+        return QByteArray(str, qsizetype(len));
+    }
+    return text;
+}
+
+static bool isAggregate(redisReply* reply) {
+    switch (reply ? reply->type : REDIS_REPLY_NIL) {
+    case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_ATTR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// bulk strings are taken by length: binary safe. raw: kept as QByteArray for the caller
+// to decode (see TextOrBytes()), else QString as always
+static QVariant parseScalar(redisReply* reply, bool raw)
 {
     if (!reply) {
         return {};
     }
-    auto array = QVariantList{};
     switch (reply->type) {
     case REDIS_REPLY_STRING:
-        return QString(reply->str);
-    case REDIS_REPLY_ARRAY:
-        for (size_t i = 0; i < reply->elements; ++i) {
-            array.append(parseReply(reply->element[i]));
+    case REDIS_REPLY_VERB:
+        if (raw) {
+            return QByteArray(reply->str, qsizetype(reply->len));
         }
-        return array;
+        return QString::fromUtf8(reply->str, qsizetype(reply->len));
     case REDIS_REPLY_INTEGER:
         return reply->integer;
     case REDIS_REPLY_NIL:
         return {};
     case REDIS_REPLY_STATUS:
-        return QString(reply->str);
+        return QString::fromLatin1(reply->str, qsizetype(reply->len));
     case REDIS_REPLY_ERROR:
-        throw std::runtime_error(reply->str);
+        throw std::runtime_error(string(reply->str, reply->len));
     case REDIS_REPLY_DOUBLE:
         return reply->dval;
     case REDIS_REPLY_BOOL:
         return bool(reply->integer);
-    case REDIS_REPLY_MAP:
-        throw std::runtime_error("REDIS_REPLY_MAP Unsupported");
-    case REDIS_REPLY_SET:
-        for (size_t i = 0; i < reply->elements; ++i) {
-            array.append(parseReply(reply->element[i]));
-        }
-        return array;
-    case REDIS_REPLY_ATTR:
-        throw std::runtime_error("REDIS_REPLY_ATTR Unsupported");
-    case REDIS_REPLY_PUSH:
-        throw std::runtime_error("REDIS_REPLY_PUSH Unsupported");
     case REDIS_REPLY_BIGNUM:
-        return QString(reply->str);
-    case REDIS_REPLY_VERB:
-        return QString(reply->str);
+        return QString::fromLatin1(reply->str, qsizetype(reply->len));
     default:
         return {};
     }
 }
 
+static QVariant finishAggregate(redisReply* reply, QVariantList&& items)
+{
+    if (reply->type != REDIS_REPLY_MAP && reply->type != REDIS_REPLY_ATTR) {
+        return QVariant(std::move(items));
+    }
+    QVariantMap map;
+    for (qsizetype i = 0; i + 1 < items.size(); i += 2) {
+        map.insert(items[i].toString(), std::move(items[i + 1]));
+    }
+    return map;
+}
+
+// iterative: XREAD/HGETALL replies are wide and nested, lists are reserved up front
+static QVariant parseReply(redisReply* root, bool raw = false)
+{
+    if (!isAggregate(root)) {
+        return parseScalar(root, raw);
+    }
+    struct Frame {
+        redisReply* reply;
+        size_t next = 0;
+        QVariantList items;
+    };
+    std::vector<Frame> stack;
+    auto enter = [&](redisReply* reply) {
+        auto& frame = stack.emplace_back(Frame{reply});
+        frame.items.reserve(qsizetype(reply->elements));
+    };
+    enter(root);
+    for (;;) {
+        auto& top = stack.back();
+        if (top.next < top.reply->elements) {
+            auto* child = top.reply->element[top.next++];
+            if (isAggregate(child)) {
+                enter(child);
+            } else {
+                top.items.append(parseScalar(child, raw));
+            }
+            continue;
+        }
+        auto done = finishAggregate(top.reply, std::move(top.items));
+        stack.pop_back();
+        if (stack.empty()) {
+            return done;
+        }
+        stack.back().items.append(std::move(done));
+    }
+}
+
 struct Client::Impl {
 
     static void connectCallback(const redisAsyncContext *context, int status)
@@ -61,8 +123,41 @@ struct Client::Impl {
         if (status != REDIS_OK) {
             emit adapter->Error(context->errstr);
             adapter->ReconnectLater();
+        } else if (adapter->config.protocol == 3u) {
+            redisAsyncCommand(adapter->ctx, Impl::helloCallback, nullptr, "HELLO 3");
         } else {
-            redisAsyncCommand(adapter->ctx, Impl::dbCallback, nullptr, "SELECT %d", adapter->config.db.value);
+            selectDb(adapter);
+        }
+    }
+
+    static void selectDb(Client* adapter) {
+        redisAsyncCommand(adapter->ctx, Impl::dbCallback, nullptr, "SELECT %d", adapter->config.db.value);
+    }
+
+    static void helloCallback(redisAsyncContext* ctx, void *reply, void*)
+    {
+        auto cast = static_cast<redisReply*>(reply);
+        auto adapter = static_cast<Client*>(ctx->data);
+        try {
+            if (!cast) Raise("null reply");
+            auto resp = parseReply(cast).toMap();
+            if (resp.value("proto").toInt() != 3) Raise("Server did not switch to RESP3");
+            selectDb(adapter);
+        } catch (std::exception& e) {
+            emit adapter->Error(QString("HELLO 3: ") + e.what());
+            adapter->ReconnectLater();
+        }
+    }
+
+    // RESP3 out-of-band messages (invalidations, ...); pub/sub messages still go to their subscriber
+    static void pushCallback(redisAsyncContext* ctx, void *reply)
+    {
+        auto cast = static_cast<redisReply*>(reply);
+        auto adapter = static_cast<Client*>(ctx->data);
+        try {
+            emit adapter->Push(parseReply(cast).toList());
+        } catch (std::exception& e) {
+            emit adapter->Error(QString("PUSH: ") + e.what());
         }
     }
 
@@ -73,6 +168,7 @@ struct Client::Impl {
         emit adapter->ConnectedChanged(false);
     }
 
+    template<bool raw>
     static void privateCallback(redisAsyncContext* ctx, void *reply, void *_data) noexcept try
     {
         auto cast = static_cast<redisReply*>(reply);
@@ -83,7 +179,7 @@ struct Client::Impl {
         Unref(data);
         try {
             if (!cast) Raise("null reply");
-            promise(parseReply(cast));
+            promise(parseReply(cast, raw));
         } catch (...) {
             promise(std::current_exception());
         }
@@ -112,11 +208,14 @@ struct Client::Impl {
 
 };
 
-radapter::redis::Client::Client(Config _conf, Worker *parent) :
+radapter::redis::Client::Client(Config _conf, QObject *parent) :
     QObject(parent),
     config(std::move(_conf))
 {
-    logger = parent;
+    logger = qobject_cast<Worker*>(parent);
+    if (config.protocol != 2u && config.protocol != 3u) {
+        Raise("redis: protocol must be 2 or 3");
+    }
     setObjectName(QString("Client(%1:%2)")
                       .arg(config.host.value.c_str())
                       .arg(config.port.value));
@@ -156,6 +255,11 @@ bool Client::IsConnected() const
     return ok;
 }
 
+unsigned Client::Protocol() const
+{
+    return config.protocol;
+}
+
 static string redisFormat(const string_view *argv, size_t argc) {
     string res = fmt::format(FMT_COMPILE("*{}\r\n"), argc);
     for (size_t i = 0; i < argc; ++i) {
@@ -164,7 +268,7 @@ static string redisFormat(const string_view *argv, size_t argc) {
     return res;
 }
 
-Future<QVariant> Client::Execute(const string_view *argv, size_t argc)
+Future<QVariant> Client::Execute(const string_view *argv, size_t argc, bool raw)
 {
     if (!ctx) {
         return fut::Rejected<QVariant>(Err("Not connected"));
@@ -180,7 +284,8 @@ Future<QVariant> Client::Execute(const string_view *argv, size_t argc)
     }
     auto promise = Promise<QVariant>{};
     auto fut = promise.GetFuture();
-    auto status = redisAsyncFormattedCommand(ctx, Impl::privateCallback, fut.PeekState(), prep.c_str(), prep.size());
+    auto callback = raw ? Impl::privateCallback<true> : Impl::privateCallback<false>;
+    auto status = redisAsyncFormattedCommand(ctx, callback, fut.PeekState(), prep.c_str(), prep.size());
     if (status != REDIS_OK) {
         promise(Err("Could not run command: {} => ", argv[0], ctx->errstr));
         ReconnectLater();
@@ -191,11 +296,18 @@ Future<QVariant> Client::Execute(const string_view *argv, size_t argc)
     return fut;
 }
 
+namespace {
+struct Subscription {
+    Client::Subscriber sub;
+    std::function<void()> subscribed;
+};
+}
+
 static void subCallback(redisAsyncContext* ctx, void *reply, void *_data) noexcept
 {
     auto adapter = static_cast<Client*>(ctx->data);
     auto cast = static_cast<redisReply*>(reply);
-    auto* data = static_cast<Client::Subscriber*>(_data);
+    auto* data = static_cast<Subscription*>(_data);
     try {
         if (!cast) Raise("null reply");
         auto r = parseReply(cast).toStringList();
@@ -203,7 +315,9 @@ static void subCallback(redisAsyncContext* ctx, void *reply, void *_data) noexce
             Raise("Invalid responce: small list?");
         }
         if (r[0] == "pmessage") {
-            (*data)(Client::SubEvent{std::move(r[2]), std::move(r[3])});
+            data->sub(Client::SubEvent{std::move(r[2]), std::move(r[3])});
+        } else if (r[0] == "psubscribe" && data->subscribed) {
+            data->subscribed();
         }
     } catch (std::exception& e) {
         emit adapter->Error(QString("PSUB: ") + e.what());
@@ -211,12 +325,12 @@ static void subCallback(redisAsyncContext* ctx, void *reply, void *_data) noexce
     }
 }
 
-void Client::PSubscribe(string_view glob, Subscriber _sub)
+void Client::PSubscribe(string_view glob, Subscriber _sub, std::function<void()> subscribed)
 {
     if (!ctx) {
         Raise("Not connected");
     }
-    auto* sub = new Subscriber(std::move(_sub));
+    auto* sub = new Subscription{std::move(_sub), std::move(subscribed)};
     auto status = redisAsyncCommand(ctx, subCallback, sub, "PSUBSCRIBE %s", string{glob}.c_str());
     if (status != REDIS_OK) {
         Raise("Could not psubscribe to: {}", glob);
@@ -242,6 +356,7 @@ void radapter::redis::Client::doConnect() {
     adapter->SetContext(ctx);
     redisAsyncSetConnectCallback(ctx, Impl::connectCallback);
     redisAsyncSetDisconnectCallback(ctx, Impl::disconnectCallback);
+    redisAsyncSetPushCallback(ctx, Impl::pushCallback);
     if (ctx->err) {
         emit Error(ctx->errstr);
         ReconnectLater();
@@ -254,3 +369,185 @@ void Client::ReconnectLater()
     reconPending = true;
     QTimer::singleShot(int(config.reconnect_timeout), this, &Client::doConnect);
 }
+
+Connection::Connection(ConnectionConfig conf, Instance *parent) :
+    QObject(parent),
+    config(std::move(conf))
+{
+    if (!config.pool_size) {
+        Raise("redis: pool_size must be at least 1");
+    }
+    if (config.protocol != 2u && config.protocol != 3u) {
+        Raise("redis: protocol must be 2 or 3");
+    }
+    setObjectName(QString("Connection(%1:%2/%3)")
+                      .arg(config.host.value.c_str())
+                      .arg(config.port.value)
+                      .arg(config.db.value));
+}
+
+Client* Connection::open(QString const& name)
+{
+    auto* client = new Client(config, this);
+    client->setObjectName(name);
+    auto inst = static_cast<Instance*>(parent());
+    connect(client, &Client::Error, this, [inst, client](QString err){
+        inst->Error("redis", "{}: {}", client->objectName(), err);
+    });
+    connect(client, &Client::ConnectedChanged, this, [inst, client](bool ok){
+        if (ok) {
+            inst->Info("redis", "{}: connected", client->objectName());
+        } else {
+            inst->Warn("redis", "{}: disconnected", client->objectName());
+        }
+    });
+    client->Start();
+    return client;
+}
+
+Client* Connection::Commands()
+{
+    if (pool.size() < config.pool_size) {
+        return pool.emplace_back(open(objectName() + QString("#%1").arg(pool.size())));
+    }
+    return pool[next++ % pool.size()];
+}
+
+Client* Connection::PubSub()
+{
+    if (!pubsub) {
+        pubsub = open(objectName() + "_sub");
+        connect(pubsub, &Client::ConnectedChanged, this, [this](bool ok){
+            confirmed.clear();
+            if (!ok) return;
+            for (auto& it: listeners) {
+                subscribe(it.first);
+            }
+        });
+    }
+    return pubsub;
+}
+
+void Connection::PSubscribe(string const& glob, QObject* ctx, Client::Subscriber sub, std::function<void()> subscribed)
+{
+    bool fresh = listeners.find(glob) == listeners.end();
+    listeners[glob].push_back(Listener{ctx, std::move(sub), subscribed});
+    // otherwise subscribed on connect
+    if (fresh && PubSub()->IsConnected()) {
+        subscribe(glob);
+    } else if (subscribed && confirmed.count(glob)) {
+        subscribed();
+    }
+}
+
+void Connection::subscribe(string const& glob)
+{
+    auto ref = QPointer(this);
+    pubsub->PSubscribe(glob, [this, ref, glob](Client::SubEvent ev){
+        if (!ref) return;
+        dispatch(glob, ev);
+    }, [this, ref, glob]{
+        if (!ref) return;
+        confirm(glob);
+    });
+}
+
+void Connection::dispatch(string const& glob, Client::SubEvent const& ev)
+{
+    auto it = listeners.find(glob);
+    if (it == listeners.end()) {
+        return;
+    }
+    auto& list = it->second;
+    list.erase(std::remove_if(list.begin(), list.end(), [](Listener const& l){
+        return !l.ctx;
+    }), list.end());
+    // a listener may subscribe from its callback: iterate over a copy
+    auto current = list;
+    for (auto& l: current) {
+        if (l.ctx) l.sub(ev);
+    }
+}
+
+void Connection::confirm(string const& glob)
+{
+    confirmed.insert(glob);
+    auto it = listeners.find(glob);
+    if (it == listeners.end()) {
+        return;
+    }
+    auto current = it->second;
+    for (auto& l: current) {
+        if (l.ctx && l.subscribed) l.subscribed();
+    }
+}
+
+Script::Script(QByteArray _source) :
+    source(std::move(_source)),
+    sha(QCryptographicHash::hash(source, QCryptographicHash::Sha1).toHex().toStdString())
+{}
+
+static string scriptArg(QVariant const& v) {
+    if (v.metaType().id() == QMetaType::QByteArray) {
+        return v.toByteArray().toStdString();
+    }
+    return v.toString().toStdString();
+}
+
+static void settle(Promise<QVariant>& promise, Result<QVariant>& res) noexcept {
+    try {
+        promise(res.get());
+    } catch (...) {
+        promise(std::current_exception());
+    }
+}
+
+Future<QVariant> Script::Run(Client *client, QVariantList const& keys, QVariantList const& args) const
+{
+    // shared: sent again as is after a reload, which may outlive this Script. Owns all its args
+    auto cmd = std::make_shared<RedisCmd>("EVALSHA");
+    cmd->Temp(string{sha});
+    cmd->Temp(std::to_string(keys.size()));
+    for (auto& k: keys) {
+        cmd->Temp(scriptArg(k));
+    }
+    for (auto& a: args) {
+        cmd->Temp(scriptArg(a));
+    }
+    auto promise = std::make_shared<Promise<QVariant>>();
+    auto result = promise->GetFuture();
+    client->Execute(*cmd)
+        .AtLastSync([client = QPointer(client), cmd, promise, source = source](Result<QVariant> res) mutable noexcept {
+            try {
+                (*promise)(res.get());
+                return;
+            } catch (std::exception& e) {
+                if (!client || string_view(e.what()).substr(0, 8) != "NOSCRIPT") {
+                    (*promise)(std::current_exception());
+                    return;
+                }
+            } catch (...) {
+                (*promise)(std::current_exception());
+                return;
+            }
+            RedisCmd load("SCRIPT");
+            load.Arg("LOAD");
+            load.Arg(string_view{source.constData(), size_t(source.size())});
+            client->Execute(load)
+                .AtLastSync([client, cmd, promise](Result<QVariant> loaded) mutable noexcept {
+                    // compile errors of the script are reported from here
+                    try {
+                        loaded.get();
+                        if (!client) Raise("client destroyed");
+                    } catch (...) {
+                        (*promise)(std::current_exception());
+                        return;
+                    }
+                    client->Execute(*cmd)
+                        .AtLastSync([promise](Result<QVariant> res) mutable noexcept {
+                            settle(*promise, res);
+                        });
+                });
+        });
+    return result;
+}
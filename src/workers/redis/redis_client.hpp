@@ -3,6 +3,7 @@
 #include "future/future.hpp"
 #include "radapter/radapter.hpp"
 #include <forward_list>
+#include <set>
 
 class QtRedisAdapter;
 struct redisAsyncContext;
@@ -14,6 +15,7 @@ struct Config : WorkerConfig {
     WithDefault<uint16_t> port = uint16_t(6379);
     WithDefault<uint16_t> db = uint16_t(0);
     WithDefault<unsigned> reconnect_timeout = 1000u;
+    WithDefault<unsigned> protocol = 2u; // 3: RESP3 (HELLO 3), needs Redis 6+
 };
 
 DESCRIBE("redis::Config", Config, void) {
@@ -22,6 +24,14 @@ DESCRIBE("redis::Config", Config, void) {
     MEMBER("port", &_::port);
     MEMBER("db", &_::db);
     MEMBER("reconnect_timeout", &_::reconnect_timeout);
+    MEMBER("protocol", &_::protocol);
+}
+
+//! UTF-8 becomes QString, anything else stays QByteArray. For values of raw replies,
+//! decoded where they are used: replies without RedisCmd::raw are QString already
+QVariant TextOrBytes(const char* str, size_t len);
+inline QVariant TextOrBytes(QByteArray const& bytes) {
+    return TextOrBytes(bytes.constData(), size_t(bytes.size()));
 }
 
 struct RedisCmd {
@@ -39,6 +49,8 @@ struct RedisCmd {
     void Temp(string&& arg) {
         args.push_back(string_view{temp_args.emplace_front(std::move(arg))});
     }
+    //! reply bulk strings are returned as QByteArray, without UTF-8 decoding
+    bool raw = false;
 private:
     std::forward_list<std::string> temp_args;
     std::vector<std::string_view> args;
@@ -56,15 +68,17 @@ class Client : public QObject {
     QtRedisAdapter* adapter{};
     redisAsyncContext* ctx{};
 public:
-    // weak: hiredis callbacks may fire while the owning worker is mid-destruction
+    // weak: hiredis callbacks may fire while the owning worker is mid-destruction.
+    // null for clients of a shared Connection, which logs for them
     QPointer<Worker> logger;
 
-    Client(Config conf, Worker* parent);
+    Client(Config conf, QObject* parent);
     ~Client() override;
     void Start();
     bool IsConnected() const;
+    unsigned Protocol() const;
     void ReconnectLater();
-    fut::Future<QVariant> Execute(const string_view* argv, size_t argc);
+    fut::Future<QVariant> Execute(const string_view* argv, size_t argc, bool raw = false);
     fut::Future<QVariant> Execute(std::initializer_list<string_view> args) {
         return Execute(&*args.begin(), args.size());
     }
@@ -73,16 +87,73 @@ public:
         QString message;
     };
     using Subscriber = std::function<void(SubEvent)>;
-    void PSubscribe(string_view glob, Subscriber sub);
+    //! `subscribed` is called once the server confirms the subscription: messages
+    //! published from then on are delivered
+    void PSubscribe(string_view glob, Subscriber sub, std::function<void()> subscribed = {});
     fut::Future<QVariant> Execute(RedisCmd const& args) {
-        return Execute(args.args.data(), args.args.size());
+        return Execute(args.args.data(), args.args.size(), args.raw);
     }
 signals:
     void Error(QString err);
     void ConnectedChanged(bool state);
+    //! RESP3 push messages that are not pub/sub, e.g. {"invalidate", {keys...}}
+    void Push(QVariantList msg);
 private:
     struct Impl;
     void doConnect();
 };
 
+//! Server-side script called by SHA (EVALSHA). The SHA is computed locally, the script is
+//! sent with SCRIPT LOAD only when the server answers NOSCRIPT (first use, restart, SCRIPT FLUSH)
+class Script {
+    QByteArray source;
+    string sha;
+public:
+    explicit Script(QByteArray source);
+    string const& Sha() const { return sha; }
+    //! keys and args are sent as separate arguments: QByteArray as is, anything else as string
+    fut::Future<QVariant> Run(Client* client, QVariantList const& keys, QVariantList const& args) const;
+};
+
+struct ConnectionConfig : Config {
+    WithDefault<unsigned> pool_size = 2u; // command connections at most, opened as workers attach
+};
+
+DESCRIBE("redis::ConnectionConfig", ConnectionConfig, void) {
+    PARENT(Config);
+    MEMBER("pool_size", &_::pool_size);
+}
+
+//! Connections shared by workers: a small pool for commands and one pub/sub connection.
+//! Each pattern is subscribed once, messages are dispatched to all listeners of it
+class Connection : public QObject {
+    Q_OBJECT
+
+    ConnectionConfig config;
+    std::vector<Client*> pool;
+    size_t next = 0;
+    Client* pubsub = nullptr;
+    struct Listener {
+        QPointer<QObject> ctx;
+        Client::Subscriber sub;
+        std::function<void()> subscribed;
+    };
+    std::set<string> confirmed; // globs subscribed on the current pub/sub connection
+    std::map<string, std::vector<Listener>> listeners;
+public:
+    Connection(ConnectionConfig conf, Instance* parent);
+    Config const& Settings() const { return config; }
+    //! a worker keeps the client it got, so its own commands stay in order
+    Client* Commands();
+    Client* PubSub();
+    //! kept across reconnects, dropped once `ctx` is destroyed. `subscribed` is called
+    //! on every (re)subscription confirmed by the server
+    void PSubscribe(string const& glob, QObject* ctx, Client::Subscriber sub, std::function<void()> subscribed = {});
+private:
+    Client* open(QString const& name);
+    void subscribe(string const& glob);
+    void dispatch(string const& glob, Client::SubEvent const& ev);
+    void confirm(string const& glob);
+};
+
 }
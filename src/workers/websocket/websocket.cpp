@@ -2,12 +2,16 @@
 #include "builtin.hpp"
 #include <QWebSocketServer>
 #include <QWebSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtEndian>
 #include <QFile>
 #include <QSslKey>
 #include <QSslCertificate>
 #include <QTimer>
 #include <qmetaobject.h>
 #include <map>
+#include <deque>
 #include <json_view/json_view.hpp>
 #include <json_view/parse.hpp>
 #include <json_view/dump.hpp>
@@ -90,11 +94,46 @@ RAD_DESCRIBE(WsClientConfig) {
     RAD_MEMBER(reconnect_timeout);
 }
 
+enum WsSync {
+    sync_none,
+    sync_delta,
+};
+
+RAD_DESCRIBE(WsSync) {
+    MEMBER("none", sync_none);
+    MEMBER("delta", sync_delta);
+}
+
+// conflate: hold back messages, merged by path (last value wins), send them as one once drained.
+// drop_oldest: hold back up to max_client_queue messages, dropping the oldest.
+// disconnect: drop the client.
+// delta sync: skipped diffs are replaced by a snapshot, unless set to disconnect
+enum WsSlowPolicy {
+    slow_conflate,
+    slow_drop_oldest,
+    slow_disconnect,
+};
+
+RAD_DESCRIBE(WsSlowPolicy) {
+    MEMBER("conflate", slow_conflate);
+    MEMBER("drop_oldest", slow_drop_oldest);
+    MEMBER("disconnect", slow_disconnect);
+}
+
 struct WsServerConfig : WsConfig {
     uint16_t port;
 
     WithDefault<string> host = "0.0.0.0";
     WithDefault<bool> per_client = false;
+    // delta: messages are merged into one state, clients get a snapshot of it on connect
+    // and only what changed afterwards
+    WithDefault<WsSync> sync = sync_none;
+    // bytes queued for a client before it counts as slow. delta: it gets no more diffs
+    // and is resynced with a snapshot once its queue has drained
+    WithDefault<unsigned> client_buffer_limit = 1u << 20;
+    // what a slow client gets instead of more queued data, see WsSlowPolicy
+    WithDefault<WsSlowPolicy> on_slow_client = slow_conflate;
+    WithDefault<unsigned> max_client_queue = 100u; // drop_oldest: messages held per client
 };
 
 RAD_DESCRIBE(WsServerConfig) {
@@ -102,6 +141,10 @@ RAD_DESCRIBE(WsServerConfig) {
     RAD_MEMBER(port);
     RAD_MEMBER(host);
     RAD_MEMBER(per_client);
+    RAD_MEMBER(sync);
+    RAD_MEMBER(client_buffer_limit);
+    RAD_MEMBER(on_slow_client);
+    RAD_MEMBER(max_client_queue);
 }
 
 using namespace jv;
@@ -131,6 +174,33 @@ static QByteArray prepareMsg(WsConfig const& config, QVariant const& _state) {
 }
 
 
+// RFC 6455 5.2: a single unfragmented frame, server frames are never masked
+static QByteArray makeFrame(bool binary, QByteArray const& payload) {
+    auto size = payload.size();
+    QByteArray frame;
+    frame.reserve(size + 10);
+    frame.append(char(0x80 | (binary ? 0x2 : 0x1)));
+    if (size < 126) {
+        frame.append(char(size));
+    } else if (size <= 0xFFFF) {
+        char len[2];
+        qToBigEndian<quint16>(quint16(size), len);
+        frame.append(char(126));
+        frame.append(len, 2);
+    } else {
+        char len[8];
+        qToBigEndian<quint64>(quint64(size), len);
+        frame.append(char(127));
+        frame.append(len, 8);
+    }
+    frame.append(payload);
+    return frame;
+}
+
+static QString peerKey(QAbstractSocket* sock) {
+    return QString("%1:%2").arg(sock->peerAddress().toString()).arg(sock->peerPort());
+}
+
 static QVariant recvFrom(QWebSocket* sock, Worker* self, WsConfig const& config, QByteArray msg) {
     QVariant fromClient;
     {
@@ -165,7 +235,32 @@ class Server : public Worker {
 
     WsServerConfig config;
     QWebSocketServer* server = nullptr;
-    std::map<QString, QWebSocket*> socks;
+    //! plain mode: connections are accepted here and handed to `server`, so their
+    //! sockets are known and broadcasts can write one prebuilt frame to all of them
+    QTcpServer* tcp = nullptr;
+    std::map<QString, QPointer<QTcpSocket>> handshaking;
+    //! payload plus what is derived from it once and shared by all clients
+    struct Encoded {
+        QByteArray payload;
+        QByteArray frame;
+        QString text;
+    };
+    struct Peer {
+        QWebSocket* ws;
+        QPointer<QTcpSocket> raw; // null with TLS: QWebSocketServer owns the handshake
+        bool behind = false; // delta: diffs skipped, snapshot due once drained
+        std::map<string, QVariant> conflated; // by path, see slow_conflate
+        std::deque<Encoded> backlog; // see slow_drop_oldest
+        // counters, see Clients()
+        quint64 sent = 0;
+        quint64 dropped = 0;
+        quint64 merged = 0;
+        quint64 resyncs = 0;
+        qint64 maxQueued = 0;
+    };
+    std::map<QString, Peer> socks;
+    QVariant state; // delta: everything sent so far, merged
+    optional<Encoded> snapshot; // delta: `state` encoded, reset on change
 public:
     Server(WsServerConfig conf, Instance* inst) :
         Worker(inst,
@@ -183,8 +278,26 @@ public:
         server = new QWebSocketServer(config.origin, mode, this);
         if (ssl) {
             server->setSslConfiguration(*ssl);
+        } else {
+            tcp = new QTcpServer(this);
+            connect(tcp, &QTcpServer::newConnection, this, [this]{
+                while (auto* sock = tcp->nextPendingConnection()) {
+                    auto key = peerKey(sock);
+                    handshaking[key] = sock;
+                    connect(sock, &QObject::destroyed, this, [this, key]{
+                        auto it = handshaking.find(key);
+                        if (it != handshaking.end() && !it->second) {
+                            handshaking.erase(it);
+                        }
+                    });
+                    server->handleConnection(sock);
+                }
+            });
         }
-        if (!server->listen(QHostAddress(QString::fromStdString(config.host)), config.port)) {
+        bool listening = tcp
+            ? tcp->listen(QHostAddress(QString::fromStdString(config.host)), config.port)
+            : server->listen(QHostAddress(QString::fromStdString(config.host)), config.port);
+        if (!listening) {
             Raise("could not listen on: {}:{}", config.host.value, config.port);
         }
         Info("listening on {}:{}", config.host.value, config.port);
@@ -204,22 +317,178 @@ public:
                 auto sockIt = socks.find(it.key());
                 if (sockIt != socks.end()) {
                     targeted = true;
-                    auto toSend = prepareMsg(config, it.value());
-                    if (isBinary(config))
-                        sockIt->second->sendBinaryMessage(toSend);
-                    else
-                        sockIt->second->sendTextMessage(QString::fromUtf8(toSend));
+                    Encoded out{prepareMsg(config, it.value())};
+                    deliver(sockIt->first, sockIt->second, out, it.value());
                 }
             }
             if (targeted) return;
         }
-        auto toSend = prepareMsg(config, msg);
-        if (isBinary(config)) {
-            for (auto& [_, cli]: socks) cli->sendBinaryMessage(toSend);
+        if (config.sync == sync_delta) {
+            QVariant diff;
+            if (!MergePatch(state, msg, &diff)) {
+                return;
+            }
+            snapshot.reset();
+            Encoded out{prepareMsg(config, diff)};
+            for (auto& [addr, peer]: socks) {
+                if (peer.behind) {
+                    continue;
+                } else if (!isSlow(peer)) {
+                    send(peer, out);
+                } else if (config.on_slow_client == slow_disconnect) {
+                    dropClient(addr, peer);
+                } else {
+                    // diffs do not add up without the ones skipped: resync instead
+                    peer.behind = true;
+                }
+            }
+            return;
+        }
+        Encoded out{prepareMsg(config, msg)};
+        for (auto& [addr, peer]: socks) {
+            deliver(addr, peer, out, msg);
+        }
+    }
+
+    bool isSlow(Peer const& peer) const {
+        return queued(peer) > qint64(config.client_buffer_limit.value);
+    }
+
+    // once something is held back, later messages queue up behind it to keep the order
+    void deliver(QString const& addr, Peer& peer, Encoded& out, QVariant const& msg) {
+        if (!isSlow(peer) && peer.conflated.empty() && peer.backlog.empty()) {
+            send(peer, out);
+            return;
+        }
+        switch (config.on_slow_client) {
+        case slow_disconnect:
+            dropClient(addr, peer);
+            break;
+        case slow_conflate: {
+            FlatMap flat;
+            Flatten(flat, msg);
+            for (auto& [k, v]: flat) {
+                auto& slot = peer.conflated[k];
+                if (slot.isValid()) {
+                    peer.merged++;
+                }
+                slot = std::move(v);
+            }
+            break;
+        }
+        case slow_drop_oldest:
+            if (peer.backlog.size() >= config.max_client_queue) {
+                peer.backlog.pop_front();
+                peer.dropped++;
+            }
+            if (config.max_client_queue) {
+                prepareFor(peer, out);
+                peer.backlog.push_back(out);
+            } else {
+                peer.dropped++;
+            }
+            break;
+        }
+    }
+
+    void dropClient(QString const& addr, Peer& peer) {
+        if (peer.ws->state() != QAbstractSocket::ConnectedState) {
+            return;
+        }
+        Warn("client {} is too slow ({} bytes queued), disconnecting", addr, queued(peer));
+        peer.ws->abort();
+    }
+
+    qint64 queued(Peer const& peer) const {
+        return peer.raw ? peer.raw->bytesToWrite() : peer.ws->bytesToWrite();
+    }
+
+    void sendSnapshot(Peer& peer) {
+        if (!state.isValid()) {
+            return;
+        }
+        if (!snapshot) {
+            snapshot = Encoded{prepareMsg(config, state)};
+        }
+        send(peer, *snapshot);
+    }
+
+    // held back messages go out once the client is below client_buffer_limit again
+    void onDrained(QString const& addr) {
+        auto it = socks.find(addr);
+        if (it == socks.end()) {
+            return;
+        }
+        auto& peer = it->second;
+        if (peer.behind) {
+            if (!queued(peer)) {
+                Debug("resyncing client {}", addr);
+                peer.behind = false;
+                peer.resyncs++;
+                sendSnapshot(peer);
+            }
+            return;
+        }
+        while (!peer.backlog.empty() && !isSlow(peer)) {
+            send(peer, peer.backlog.front());
+            peer.backlog.pop_front();
+        }
+        if (!peer.conflated.empty() && !isSlow(peer)) {
+            FlatMap flat;
+            flat.reserve(peer.conflated.size());
+            for (auto& [k, v]: peer.conflated) {
+                flat.push_back({k, std::move(v)});
+            }
+            peer.conflated.clear();
+            QVariant merged;
+            Unflatten(merged, flat);
+            Encoded out{prepareMsg(config, merged)};
+            send(peer, out);
+        }
+    }
+
+    // Clients() -> {[addr] = {queued_bytes, max_queued_bytes, held, sent, dropped, merged, resyncs}}
+    QVariantMap Clients() {
+        QVariantMap res;
+        for (auto& [addr, peer]: socks) {
+            res[addr] = QVariantMap{
+                {"queued_bytes", queued(peer)},
+                {"max_queued_bytes", peer.maxQueued},
+                {"held", qulonglong(peer.backlog.size() + peer.conflated.size())},
+                {"sent", peer.sent},
+                {"dropped", peer.dropped},
+                {"merged", peer.merged},
+                {"resyncs", peer.resyncs},
+            };
+        }
+        return res;
+    }
+
+    // fills in what this kind of client needs, at most once per message
+    void prepareFor(Peer const& peer, Encoded& out) {
+        if (peer.raw) {
+            if (out.frame.isEmpty()) {
+                out.frame = makeFrame(isBinary(config), out.payload);
+            }
+        } else if (!isBinary(config) && out.text.isNull()) {
+            out.text = QString::fromUtf8(out.payload);
+        }
+    }
+
+    void send(Peer& peer, Encoded& out) {
+        if (peer.ws->state() != QAbstractSocket::ConnectedState) {
+            return;
+        }
+        prepareFor(peer, out);
+        if (peer.raw) {
+            peer.raw->write(out.frame);
+        } else if (isBinary(config)) {
+            peer.ws->sendBinaryMessage(out.payload);
         } else {
-            auto str = QString::fromUtf8(toSend);
-            for (auto& [_, cli]: socks) cli->sendTextMessage(str);
+            peer.ws->sendTextMessage(out.text);
         }
+        peer.sent++;
+        peer.maxQueued = (std::max)(peer.maxQueued, queued(peer));
     }
 
     void accept(QWebSocket* sock) {
@@ -227,7 +496,23 @@ public:
         sock->setParent(this);
         sock->setObjectName(addr);
         Info("new client {}", addr);
-        socks[addr] = sock;
+        Peer peer{sock, {}};
+        if (auto it = handshaking.find(addr); it != handshaking.end()) {
+            peer.raw = it->second;
+            handshaking.erase(it);
+        }
+        auto& added = socks[addr] = std::move(peer);
+        if (config.sync == sync_delta) {
+            sendSnapshot(added);
+        }
+        auto drained = [this, addr]{
+            onDrained(addr);
+        };
+        if (added.raw) {
+            connect(added.raw, &QTcpSocket::bytesWritten, this, drained);
+        } else {
+            connect(sock, &QWebSocket::bytesWritten, this, drained);
+        }
         emit SendEvent(QVariantMap{{"connected", addr}});
         connect(sock, &QWebSocket::disconnected, this, [this, sock, addr]{
             Warn("client disconnected {}", addr);
@@ -303,7 +588,9 @@ public:
 }
 
 void radapter::builtin::workers::websocket(radapter::Instance* inst) {
-    inst->RegisterWorker<ws::Server>("WebsocketServer");
+    inst->RegisterWorker<ws::Server>("WebsocketServer", {
+        {"Clients", AsExtraMethod<&ws::Server::Clients>},
+    });
     inst->RegisterSchema<ws::WsServerConfig>("WebsocketServer");
     inst->RegisterWorker<ws::Client>("WebsocketClient");
     inst->RegisterSchema<ws::WsClientConfig>("WebsocketClient");
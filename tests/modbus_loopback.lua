@@ -3,14 +3,165 @@
 --
 -- Run with:
 --   build/bin/radapter tests/modbus_loopback.lua
+--
+-- Benchmark mode (no hardware needed), polls maps of growing size at growing rates:
+--   build/bin/radapter tests/modbus_loopback.lua bench [sizes=100,1000,10000,50000]
+--       [rates=1000,200,50,10] [phase=3000] [in_flight=4] [out=results.jsonl]
+-- Prints one JSON object per (size, rate) run to stdout, also appended to `out` if given.
 
 local os = require "os"
 
 local PORT = 11502
+local BENCH_PORT = 11600
+
+local function sleep(ms)
+    await(function(cb) after(ms, function() cb(true) end) end)
+end
+
+local function bench_options()
+    local opts = {
+        sizes = {100, 1000, 10000, 50000},
+        rates = {1000, 200, 50, 10},
+        phase = 3000,
+        in_flight = 4,
+    }
+    for i = 2, #args do
+        local k, v = args[i]:match("^([%w_]+)=(.*)$")
+        assert(k, "key=value expected, got: "..args[i])
+        if k == "sizes" or k == "rates" then
+            local list = {}
+            for n in v:gmatch("%d+") do list[#list + 1] = tonumber(n) end
+            opts[k] = list
+        elseif k == "phase" or k == "in_flight" then
+            opts[k] = assert(tonumber(v), k.." must be a number")
+        elseif k == "out" then
+            opts.out = v
+        else
+            error("unknown option: "..k)
+        end
+    end
+    return opts
+end
+
+-- percentiles (ms) of the requests answered between two SlaveStats() snapshots,
+-- from the difference of their latency histograms (bucket upper bounds, ~9% wide)
+local function phase_latency(h0, h1, bounds)
+    local delta, total, max = {}, 0, nil
+    for i = 1, #h1 do
+        delta[i] = h1[i] - (h0[i] or 0)
+        total = total + delta[i]
+    end
+    local res = {}
+    if total == 0 then return res end
+    for name, p in pairs({ p50_ms = 0.5, p95_ms = 0.95, p99_ms = 0.99 }) do
+        local rank, seen = math.max(1, math.ceil(p * total)), 0
+        for i = 1, #delta do
+            seen = seen + delta[i]
+            if seen >= rank then
+                res[name] = bounds[i]
+                break
+            end
+        end
+    end
+    for i = 1, #delta do
+        if delta[i] > 0 then max = i end
+    end
+    res.max_ms = bounds[max]
+    return res
+end
+
+-- one master per run on the device of this size; the previous master is destroyed
+-- before, so nothing else polls during the measured phase
+local function bench_run(opts, size, rate, device, registers)
+    local master = ModbusMaster {
+        device = device,
+        slave_id = 1,
+        poll_rate = rate,
+        registers = registers,
+    }
+    await(match_msg(master.events, function(ev)
+        return ev.state == "ConnectedState" end)
+    )
+    sleep(math.min(math.floor(opts.phase / 5), 1000)) -- warm up
+    local s0, d0, cpu0 = master:Stats().default, master:SlaveStats(), os.clock()
+    sleep(opts.phase)
+    local s1, d1, cpu1 = master:Stats().default, master:SlaveStats(), os.clock()
+    master:destroy()
+
+    local cycles = s1.cycles - s0.cycles
+    local latency = phase_latency(d0.latency_hist, d1.latency_hist, d1.latency_bounds_ms)
+    return {
+        registers = size,
+        poll_rate_ms = rate,
+        requests_per_scan = s1.requests,
+        target_scan_hz = 1000 / rate,
+        scan_hz = cycles / (opts.phase / 1000),
+        overruns = s1.overruns - s0.overruns,
+        requests = d1.requests - d0.requests,
+        errors = d1.errors - d0.errors,
+        queue_overflows = d1.overflows - d0.overflows,
+        p50_ms = latency.p50_ms,
+        p95_ms = latency.p95_ms,
+        p99_ms = latency.p99_ms,
+        max_ms = latency.max_ms,
+        -- process CPU: master and slave run in this process
+        cpu_ms_per_scan = cycles > 0 and (cpu1 - cpu0) * 1000 / cycles or nil,
+    }
+end
+
+local function bench()
+    local opts = bench_options()
+    local out = opts.out and assert(io.open(opts.out, "a"))
+    for i, size in ipairs(opts.sizes) do
+        assert(size > 0 and size <= 65536, "sizes must be in range 1-65536")
+        local holding = {}
+        for idx = 0, size - 1 do
+            holding["r"..idx] = { index = idx }
+        end
+        local registers = { holding = holding }
+        local port = BENCH_PORT + i
+        local slave = ModbusSlave {
+            device = TcpModbusServer {
+                host = "0.0.0.0",
+                port = port,
+            },
+            slave_id = 1,
+            registers = registers,
+        }
+        -- shared by all rates of this size: no reconnects between runs
+        local device = TcpModbusDevice {
+            host = "127.0.0.1",
+            port = port,
+            max_in_flight = opts.in_flight,
+        }
+        for _, rate in ipairs(opts.rates) do
+            local line = json_encode(bench_run(opts, size, rate, device, registers))
+            print(line)
+            if out then
+                out:write(line, "\n")
+                out:flush()
+            end
+        end
+        slave:destroy()
+    end
+    if out then out:close() end
+    shutdown()
+end
+
+if args[1] == "bench" then
+    bench()
+    return
+end
 
 local checks = {
     slave_to_master = true,
     master_to_slave = true,
+    poll_groups = true,
+    block = true,
+    float64 = true,
+    element_write = true,
+    poll_on_demand = true,
+    gateway = true,
 }
 
 local function pass(name)
@@ -33,8 +184,10 @@ end)
 local registers = {
     holding = {
         ["to_master"] = { index = 0 },
-        ["speed"] = { index = 1, type = "float32" },
+        ["speed"] = { index = 1, type = "float32", group = "slow" },
         ["to_slave"] = { index = 3 },
+        ["wave"] = { index = 10, type = "int16", count = 4 },
+        ["precise"] = { index = 20, type = "float64" },
     },
     coils = {
         ["flag"] = { index = 0 },
@@ -59,6 +212,7 @@ local master = ModbusMaster {
     device = device,
     slave_id = 1,
     poll_rate = 100,
+    poll_groups = { slow = 300 },
     registers = registers,
 }
 
@@ -66,6 +220,8 @@ local master = ModbusMaster {
 slave {
     to_master = 7,
     speed = 3.5,
+    wave = {1, -2, 3, -4},
+    precise = 0.1,
 }
 
 pipe(master, function(msg)
@@ -73,6 +229,20 @@ pipe(master, function(msg)
     if get(msg, "to_master") == 7 then
         pass("slave_to_master")
     end
+    local wave = get(msg, "wave")
+    if wave and wave[1] == 1 and wave[2] == -2 and wave[4] == -4 then
+        pass("block")
+    end
+    if get(msg, "precise") == 0.1 then
+        -- slave -> master done, now the other way: not representable in float32
+        master { precise = 2.718281828459045 }
+    end
+    if get(msg, "speed") == 3.5 then
+        local stats = master:Stats()
+        if stats.slow and stats.slow.cycles > 0 and stats.default.cycles > 0 then
+            pass("poll_groups")
+        end
+    end
 end)
 
 -- Master -> Slave: write over the wire, slave reports the change
@@ -85,6 +255,83 @@ master {
     flag = true,
 }
 
+-- a single block element: only its word is written, its neighbours keep their values
+master { ["wave:[2]"] = 30 }
+
+-- poll_on_demand: only registers someone listens to are read. Created on the device
+-- that is already connected, so it also has to start polling by itself
+local lazy = ModbusMaster {
+    device = device,
+    slave_id = 1,
+    poll_rate = 100,
+    poll_groups = { slow = 300 },
+    poll_on_demand = true,
+    registers = registers,
+}
+local function polled(stats)
+    local n = 0
+    for _, group in pairs(stats) do n = n + group.requests end
+    return n
+end
+local lazy_extra = false
+pipe(lazy, function(msg)
+    for k in pairs(msg) do
+        if k ~= "to_master" then lazy_extra = true end
+    end
+end)
+local cancel_lazy
+cancel_lazy = on(lazy, "to_master", function(v)
+    if v ~= 7 or not cancel_lazy then return end
+    local requests = polled(lazy:Stats())
+    cancel_lazy()
+    cancel_lazy = nil
+    -- the plan is rebuilt in the next event loop turn
+    after(50, function()
+        if requests == 1 and not lazy_extra and polled(lazy:Stats()) == 0 then
+            pass("poll_on_demand")
+        end
+    end)
+end)
+
+-- TcpModbusGateway: units 1 and 2 are local slaves, unit 3 is forwarded to another
+-- server through a master device. Each unit answers with its own value
+local GW_PORT, DOWN_PORT = PORT + 1, PORT + 2
+local unit_regs = { holding = { ["id"] = { index = 0 } } }
+local downstream = ModbusSlave {
+    device = TcpModbusServer { host = "0.0.0.0", port = DOWN_PORT },
+    slave_id = 3,
+    registers = unit_regs,
+}
+downstream { id = 30 }
+local gateway = TcpModbusGateway {
+    host = "0.0.0.0",
+    port = GW_PORT,
+    forward = {
+        { device = TcpModbusDevice { host = "127.0.0.1", port = DOWN_PORT }, units = {3} },
+    },
+}
+for unit = 1, 2 do
+    local local_unit = ModbusSlave { device = gateway, slave_id = unit, registers = unit_regs }
+    local_unit { id = unit * 10 }
+end
+local upstream = TcpModbusDevice { host = "127.0.0.1", port = GW_PORT }
+local answered = {}
+for unit = 1, 3 do
+    local through = ModbusMaster {
+        device = upstream,
+        slave_id = unit,
+        poll_rate = 100,
+        registers = unit_regs,
+    }
+    pipe(through, function(msg)
+        if get(msg, "id") ~= unit * 10 then return end
+        answered[unit] = true
+        if answered[1] and answered[2] and answered[3] then
+            pass("gateway")
+        end
+    end)
+end
+
 local got = {}
 pipe(slave, function(msg)
     log.info("SLAVE <= {}", msg)
@@ -94,4 +341,11 @@ pipe(slave, function(msg)
     if got.to_slave == 9 and got.flag == true then
         pass("master_to_slave")
     end
+    if got.precise == 2.718281828459045 then
+        pass("float64")
+    end
+    local wave = got.wave
+    if wave and wave[1] == 1 and wave[2] == -2 and wave[3] == 30 and wave[4] == -4 then
+        pass("element_write")
+    end
 end)
@@ -11,6 +11,9 @@ local checks = {
     pipe = true,
     ws_roundtrip = true,
     ws_binary_roundtrip = true,
+    ws_delta = true,
+    ws_slow_conflate = true,
+    ws_slow_drop_oldest = true,
     sql_roundtrip = true,
     service = true,
     async_unhandled = true,
@@ -64,6 +67,11 @@ pipe(server, function(msg)
 end)
 pipe(client, function(msg)
     if msg.reply == "smoke" then
+        local sent = 0
+        for _, c in pairs(server:Clients()) do
+            sent = sent + c.sent
+        end
+        assert(sent > 0, "Clients() must count sent messages")
         pass("ws_roundtrip")
     end
 end)
@@ -93,6 +101,63 @@ pipe(client2.events, function(ev)
     end
 end)
 
+-- Websocket delta sync: snapshot of earlier messages on connect, then only changes
+local server3 = WebsocketServer { port = PORT + 2, sync = "delta" }
+server3 { a = 1, b = 2 }
+local client3 = WebsocketClient { url = "ws://127.0.0.1:" .. (PORT + 2) }
+
+pipe(client3, function(msg)
+    if msg.a == 1 and msg.b == 2 then
+        server3 { a = 1, b = 3 }
+    elseif msg.a == nil and msg.b == 3 then
+        pass("ws_delta")
+    end
+end)
+
+-- Slow clients: with client_buffer_limit = 0 a client is slow while anything is still
+-- queued for it, so of three messages sent in one event loop turn only the first goes
+-- out at once. The rest is held back according to on_slow_client
+local function ws_slow(port, policy, check)
+    local srv = WebsocketServer {
+        port = port,
+        client_buffer_limit = 0,
+        on_slow_client = policy,
+        max_client_queue = 1,
+    }
+    local cli = WebsocketClient { url = "ws://127.0.0.1:" .. port }
+    local got = {}
+    pipe(cli, function(msg)
+        got[#got + 1] = msg
+        if #got ~= 2 then return end
+        -- nothing else may follow the held back message
+        after(200, function()
+            local stats
+            for _, c in pairs(srv:Clients()) do stats = c end
+            if #got == 2 and stats and check(got, stats) then
+                pass("ws_slow_" .. policy)
+            end
+        end)
+    end)
+    pipe(srv.events, function(ev)
+        if not ev.connected then return end
+        srv { n = 1 }
+        srv { n = 2, x = "a" }
+        srv { n = 3, y = "b" }
+    end)
+end
+
+-- conflate: the held messages arrive as one, merged by path
+ws_slow(PORT + 3, "conflate", function(got, stats)
+    local m = got[2]
+    return got[1].n == 1 and m.n == 3 and m.x == "a" and m.y == "b" and stats.merged == 1
+end)
+
+-- drop_oldest: only the last max_client_queue held messages arrive
+ws_slow(PORT + 4, "drop_oldest", function(got, stats)
+    local m = got[2]
+    return got[1].n == 1 and m.n == 3 and m.x == nil and stats.dropped == 1
+end)
+
 -- Sql roundtrip (in-memory sqlite)
 local db = Sql { type = "QSQLITE", db = ":memory:" }
 db:Exec("CREATE TABLE t (x int)")
@@ -184,3 +249,62 @@ end)
 -- Constructed only (no live counterpart): must not throw, reconnect in background
 local cache = RedisCache { hash_key = "smoke", reconnect_timeout = 60000 }
 local stream = RedisStream { stream_key = "smoke:stream", reconnect_timeout = 60000 }
+local shared = RedisConnection { reconnect_timeout = 60000 }
+local shared_cache = RedisCache { hash_key = "smoke:shared", connection = shared }
+local resp3_cache = RedisCache { hash_key = "smoke:resp3", protocol = 3, reconnect_timeout = 60000 }
+
+-- Live redis (set RADAPTER_TEST_REDIS=1 with a server on localhost:6379):
+-- RESP3 + CLIENT TRACKING reads the hash back from its map-shaped HGETALL reply
+if os.getenv("RADAPTER_TEST_REDIS") then
+    checks.redis_resp3 = true
+    local key = "smoke:resp3:live"
+    local writer = RedisCache { hash_key = key, mode = "w" }
+    local reader = RedisCache { hash_key = key, protocol = 3, mode = "r" }
+    pipe(reader, function(msg)
+        if msg.value == "resp3" then
+            pass("redis_resp3")
+        end
+    end)
+    after(200, function()
+        writer { value = "resp3" }
+    end)
+
+    -- sync = "changes": fields come through the changes channel, typed JSON from
+    -- other publishers included
+    checks.redis_changes = true
+    local ckey = "smoke:changes:live"
+    local cwriter = RedisCache { hash_key = ckey, mode = "w", sync = "changes" }
+    local creader = RedisCache { hash_key = ckey, mode = "r", sync = "changes" }
+    pipe(creader, function(msg)
+        if msg.value == "changed" then
+            cwriter:Exec("PUBLISH", { ckey .. ":changes", '{"count":5,"on":true}' }, function() end)
+        elseif msg.count == 5 and msg.on == true then
+            pass("redis_changes")
+        end
+    end)
+    after(200, function()
+        cwriter { value = "changed" }
+    end)
+
+    -- poll_debounce: a burst of writes is read back with one HGETALL, ending at the last value
+    checks.redis_debounce = true
+    local dkey = "smoke:debounce:live"
+    local dwriter = RedisCache { hash_key = dkey, mode = "w" }
+    local dreader = RedisCache { hash_key = dkey, mode = "r", poll_debounce = 100 }
+    local run = tostring(os.time())
+    local reads = 0
+    pipe(dreader, function(msg)
+        if msg.n == nil then return end
+        reads = reads + 1
+        if msg.n == run .. ":5" then
+            -- initial HGETALL and at most one more for the burst
+            assert(reads <= 2, "poll_debounce: burst read " .. reads .. " times")
+            pass("redis_debounce")
+        end
+    end)
+    after(200, function()
+        for n = 1, 5 do
+            after(n * 10, function() dwriter { n = run .. ":" .. n } end)
+        end
+    end)
+end
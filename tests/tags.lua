@@ -8,7 +8,7 @@ end
 
 local PORT = 17888
 
-local checks = { subscribe = true, changed = true, source = true, quality_get = true }
+local checks = { subscribe = true, changed = true, source = true, quality_get = true, stale = true, shm = true }
 local function pass(name)
     if not checks[name] then return end
     checks[name] = nil
@@ -26,6 +26,76 @@ after(3000, function()
     os.exit(1)
 end)
 
+-- Shared table, read back the way an external process would: map /dev/shm/<name>
+-- and check what the writer produced against include/radapter/tag_shm.hpp.
+-- Needs LuaJIT FFI on Linux, skipped otherwise
+local SHM_NAME = "radapter_tags_test"
+tags:share(SHM_NAME, 16)
+
+local has_ffi, ffi = pcall(require, "ffi")
+if has_ffi and ffi.os == "Linux" then
+    ffi.cdef[[
+        typedef struct {
+            uint8_t type;
+            uint8_t quality;
+            uint16_t size;
+            int64_t ts;
+            union { int64_t i; double d; char str[40]; } data;
+        } rtag_value;
+        typedef struct { uint32_t seq; rtag_value value; } rtag_slot;
+        typedef struct {
+            uint32_t magic, version, slot_count, slot_size, name_size, used;
+            int64_t pid;
+            uint8_t pad[32];
+        } rtag_header;
+        int open(const char* path, int flags);
+        int close(int fd);
+        void* mmap(void* addr, size_t len, int prot, int flags, int fd, long off);
+        int munmap(void* addr, size_t len);
+    ]]
+else
+    checks.shm = nil
+    log.warn("SKIP: shm (no LuaJIT FFI on Linux)")
+end
+
+local function check_shm()
+    local O_RDONLY, PROT_READ, MAP_SHARED = 0, 1, 1
+    local fd = ffi.C.open("/dev/shm/" .. SHM_NAME, O_RDONLY)
+    assert(fd >= 0, "shm: segment not found")
+    local hsize = ffi.sizeof("rtag_header")
+    local hdr = ffi.cast("rtag_header*", ffi.C.mmap(nil, hsize, PROT_READ, MAP_SHARED, fd, 0))
+    local count = hdr.slot_count
+    local size = hsize + count * (ffi.sizeof("rtag_slot") + 96)
+    ffi.C.munmap(hdr, hsize)
+    local base = ffi.cast("uint8_t*", ffi.C.mmap(nil, size, PROT_READ, MAP_SHARED, fd, 0))
+    ffi.C.close(fd)
+    hdr = ffi.cast("rtag_header*", base)
+    assert(hdr.magic == 0x47415452 and hdr.version == 1, "shm: bad magic/version")
+    assert(hdr.slot_count == 16, "shm: bad slot count")
+    assert(hdr.slot_size == ffi.sizeof("rtag_slot") and hdr.name_size == 96, "shm: layout mismatch")
+    local slots = ffi.cast("rtag_slot*", base + hsize)
+    local dir = ffi.cast("char*", base + hsize + count * ffi.sizeof("rtag_slot"))
+    local function find(name)
+        for i = 0, hdr.used - 1 do
+            if ffi.string(dir + i * 96) == name then return slots[i] end
+        end
+    end
+
+    local hello, n = find("ws.cli:hello"), find("ws.cli:n")
+    assert(hello and n, "shm: tags not published")
+    -- the writer runs on this thread: every write is complete, `seq` even and non-zero
+    for _, slot in ipairs({hello, n}) do
+        assert(slot.seq > 0 and slot.seq % 2 == 0, "shm: seq not even after a write")
+    end
+    local v = hello.value
+    assert(v.type == 4 and v.quality == 0 and ffi.string(v.data.str, v.size) == "world", "shm: bad string")
+    assert(v.ts > 0, "shm: no timestamp")
+    v = n.value
+    assert(v.type == 2 and tonumber(v.data.i) == 42, "shm: bad int")
+    ffi.C.munmap(base, size)
+    return true
+end
+
 local server = WebsocketServer { port = PORT, name = "ws.srv" }
 local client = WebsocketClient { url = "ws://127.0.0.1:" .. PORT, name = "ws.cli" }
 
@@ -36,6 +106,14 @@ tags:subscribe("ws.cli:hello", function(ev)
     end
 end)
 
+-- A tag that stops updating while the link stays up goes stale
+tags:max_age("ws.cli", 300)
+tags:subscribe("ws.cli:hello", function(ev)
+    if ev.quality == "stale" and ev.value == "world" then
+        pass("stale")
+    end
+end)
+
 -- pipe(tags.changed) fires for any tag update
 pipe(tags.changed, function(ev)
     if ev.name == "ws.srv:hello" and ev.value == "world" then
@@ -57,11 +135,15 @@ pipe(client, function(msg)
     if t and t.value == "world" and t.quality == "good" then
         pass("quality_get")
     end
+
+    if checks.shm and check_shm() then
+        pass("shm")
+    end
 end)
 
 pipe(client.events, function(ev)
     if ev.state == "ConnectedState" then
-        server { hello = "world" }
+        server { hello = "world", n = 42 }
         client { hello = "world" }
     end
 end)